@@ -1,5 +1,5 @@
 #!/usr/bin/python
-import sys,os,re,string,sha,stat
+import sys,os,re,string,hashlib,stat
 
 # call to main() is at the bottom of the script
 
@@ -109,36 +109,85 @@ def check_file(eccdirs, path):
             error("mismatch on sha1_file_hash")
         if eccfile.sha1_crosschunk_hash != sha1_crosschunk_hash:
             error("mismatch on crosschunk hash")
+        if eccfile.hash_type != files[0].hash_type:
+            error("mismatch on hash type")
     files.sort(lambda x,y: cmp(x.chunknum, y.chunknum))
 
-    sha1 = sha.new()
-    sha1_filehash = sha.new()
+    sha1 = ChunkHash(files[0].hash_type)
+    sha1_filehash = ChunkHash(files[0].hash_type)
     for i in range(len(files)):
         f = files[i]
         if f.chunknum != i:
             error("missing chunk")
         sha1.update(f.header + f.sha1_file_hash + f.sha1_data_digest)
-        if i < n:
+        if i < n and f.stripe_unit == 0:
             bytes = f.chunk_size
             if i == n-1:
                 bytes = f.chunk_size - f.under_size
             f.sha_filedata(sha1_filehash, bytes)
+    if files[0].stripe_unit != 0:
+        sha_striped(files[0:n], sha1_filehash)
 
     if sha1.digest() != sha1_crosschunk_hash:
         error("bad crosschunk hash")
     if sha1_filehash.digest() != sha1_file_hash:
         error("bad file hash")
         
+# Version 3 files, and version 4 ones with a stripe unit, go round the data chunks a stripe unit at a time; if
+# the chunks aren't a whole number of units the last row uses what is
+# left of each.  See gflib/header.h
+def sha_striped(files, sha1):
+    n = len(files)
+    blocksize = files[0].chunk_size
+    unit = min(files[0].stripe_unit, blocksize)
+    remain = files[0].file_size
+    offset = 0
+    while remain > 0:
+        if offset + unit > blocksize:
+            unit = blocksize - offset
+        for f in files:
+            bytes = min(unit, remain)
+            f.sha_range(sha1, offset, bytes)
+            remain -= bytes
+        offset += unit
+
 def unionreaddir(eccdirs, basedir):
     found = {}
     for eccdir in eccdirs:
         for file in os.listdir(eccdir + basedir):
+            # .eccfs-* files (e.g. the verify journal) are eccfs's own
+            if file.startswith('.eccfs-'):
+                continue
             found[file] = 1
     ret = found.keys()
     ret.sort()
     print "unionreaddr(" + basedir + "): " + str(ret)
     return ret
 
+# The hashes in a chunk are SHA1, or for version 4 whichever hash
+# its header_v2 names, cut down to 20 bytes.  See gflib/chunk_hash.h
+hash_names = [ ['sha1'], ['sha256'], ['blake2s', 'blake2s256'] ]
+
+class ChunkHash:
+    def __init__(self, hash_type, data = ''):
+        if hash_type >= len(hash_names):
+            error("unknown hash type " + str(hash_type))
+        for name in hash_names[hash_type]:
+            try:
+                self.h = hashlib.new(name)
+                break
+            except ValueError:
+                pass
+        else:
+            error("this python has no " + hash_names[hash_type][0])
+        self.h.update(data)
+
+    def update(self, data):
+        self.h.update(data)
+
+    def digest(self):
+        return self.h.digest()[0:20]
+
 class ECCFile:
     "Class for verifying ecc files"
 
@@ -147,7 +196,8 @@ class ECCFile:
         self.file = open(filename, 'r')
 
         self.header = self.xread(4)
-        if ord(self.header[0]) != 1:
+        self.version = ord(self.header[0])
+        if self.version < 1 or self.version > 4:
             error("bad version in file " + filename)
         self.under_size = ord(self.header[1])
         a = ord(self.header[2])
@@ -161,17 +211,47 @@ class ECCFile:
         self.sha1_chunk_hash = self.xread(20)
 
         statbits = os.fstat(self.file.fileno())
-        self.chunk_size = statbits[stat.ST_SIZE] - (4+3*20)
+        self.stripe_unit = 0
+        self.hash_type = 0
+        if self.version == 1:
+            self.data_offset = 4+3*20
+            self.chunk_size = statbits[stat.ST_SIZE] - self.data_offset
+        else:
+            # see gflib/header.h for the version 2 to 4 layouts
+            self.header_v2 = self.xread(8)
+            self.hash_block_size = 1 << ord(self.header_v2[0])
+            stripe_shift = ord(self.header_v2[1])
+            if self.version == 3 or (self.version == 4 and stripe_shift != 0):
+                if stripe_shift < ord(self.header_v2[0]) or stripe_shift > 30:
+                    error("bad stripe unit in file " + filename)
+                self.stripe_unit = 1 << stripe_shift
+            elif stripe_shift != 0:
+                error("bad version 2 header in file " + filename)
+            if self.version == 4:
+                self.hash_type = ord(self.header_v2[2])
+            elif ord(self.header_v2[2]) != 0:
+                error("bad version " + str(self.version) + " header in file " + filename)
+            remain = statbits[stat.ST_SIZE] - (4+3*20+8)
+            nblocks = (remain + self.hash_block_size + 19) / (self.hash_block_size + 20)
+            self.chunk_size = remain - 20 * nblocks
+            if (self.chunk_size + self.hash_block_size - 1) / self.hash_block_size != nblocks:
+                error("bad hash table size in file " + filename)
+            self.block_hashes = self.xread(20 * nblocks)
+            self.data_offset = 4+3*20+8 + 20 * nblocks
         self.file_size = self.chunk_size * self.n - self.under_size
 
-        sha1 = sha.new()
-        self.sha_remaining(sha1, self.chunk_size)
+        if self.version == 1:
+            sha1 = ChunkHash(self.hash_type)
+            self.sha_remaining(sha1, self.chunk_size)
+            self.sha1_data_digest = sha1.digest()
+        else:
+            self.check_blocks()
+            self.sha1_data_digest = ChunkHash(self.hash_type, self.header_v2 + self.block_hashes).digest()
         tmp = self.file.read(1)
         if len(tmp) != 0:
             error("Found extra data at end of file")
-        self.sha1_data_digest = sha1.digest()
 
-        sha1 = sha.new()
+        sha1 = ChunkHash(self.hash_type)
         sha1.update(self.header + self.sha1_file_hash
                     + self.sha1_crosschunk_hash)
         sha1.update(self.sha1_data_digest)
@@ -183,9 +263,25 @@ class ECCFile:
         # print filename + ": n=" + str(self.n) + ", m=" + str(self.m) + ", chunknum=" + str(self.chunknum)
 
     def sha_filedata(self, sha1, bytes):
-        self.file.seek(4+3*20)
+        self.sha_range(sha1, 0, bytes)
+
+    def sha_range(self, sha1, offset, bytes):
+        self.file.seek(self.data_offset + offset)
         self.sha_remaining(sha1, bytes)
 
+    def check_blocks(self):
+        remain = self.chunk_size
+        i = 0
+        while remain > 0:
+            amt = min(remain, self.hash_block_size)
+            data = self.file.read(amt)
+            if len(data) != amt:
+                error("did not read expected amount")
+            if ChunkHash(self.hash_type, data).digest() != self.block_hashes[20*i:20*(i+1)]:
+                error("Mismatch on block " + str(i) + " hash in " + self.filename)
+            remain -= amt
+            i += 1
+
     def sha_remaining(self, sha1, bytes):
         while bytes > 0:
             amt = bytes
@@ -0,0 +1,41 @@
+/*
+    (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+    See the file named COPYING for license details
+*/
+
+/* The layout functions of gflib/header.h for ChunkHeader.H, whose
+   struct header and struct header_v2 are the same bytes as gflib's
+   but can't share a translation unit with them. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gflib/header.h"
+
+int eccfs_header_v2_valid(unsigned version, const void *ext)
+{
+    return header_v2_valid(version, (struct header_v2 *) ext);
+}
+
+int eccfs_chunk_layout_from_size(const void *hdr, const void *ext,
+				 unsigned long long file_size, struct chunk_layout *l)
+{
+    return chunk_layout_from_size((struct header *) hdr, (struct header_v2 *) ext,
+				  file_size, l);
+}
+
+unsigned long long eccfs_chunk_locate(const struct chunk_layout *l, unsigned n,
+				      unsigned long long pos, unsigned *chunknum,
+				      unsigned long long *chunk_offset)
+{
+    return chunk_locate(l, n, pos, chunknum, chunk_offset);
+}
+
+unsigned long long eccfs_chunk_file_offset(const struct chunk_layout *l, unsigned n,
+					   unsigned chunknum,
+					   unsigned long long chunk_offset)
+{
+    unsigned long long run;
+    return chunk_file_offset(l, n, chunknum, chunk_offset, &run);
+}
@@ -0,0 +1,210 @@
+/*
+   (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+
+   The EVP digests are looked up once; with OpenSSL 3 that is an
+   explicit fetch, since passing EVP_sha256() and friends to
+   EVP_DigestInit_ex fetches the implementation again every time.
+
+   chunk_hash_blocks starts its threads on every call rather than
+   keeping a pool, so that nothing is left running across a fork
+   (eccfs is set up before fuse forks into the background) and
+   callers need no setup.  It only goes parallel when each thread
+   gets CHUNK_HASH_THREAD_BYTES or more, which is well over the cost
+   of starting one.
+*/
+
+#define _XOPEN_SOURCE 600
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+
+#include "chunk_hash.h"
+
+#define CHUNK_HASH_THREAD_BYTES (256*1024)
+#define CHUNK_HASH_MAX_THREADS 16
+
+struct chunk_hash_ctx {
+  EVP_MD_CTX *ctx;
+  const EVP_MD *md;
+};
+
+static const char *names[CHUNK_HASH_TYPES] = { "sha1", "sha256", "blake2s" };
+static const EVP_MD *mds[CHUNK_HASH_TYPES];
+static pthread_once_t mds_once = PTHREAD_ONCE_INIT;
+
+static void fetch_mds(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  mds[CHUNK_HASH_SHA1] = EVP_MD_fetch(NULL, "SHA1", NULL);
+  mds[CHUNK_HASH_SHA256] = EVP_MD_fetch(NULL, "SHA256", NULL);
+  mds[CHUNK_HASH_BLAKE2S] = EVP_MD_fetch(NULL, "BLAKE2S-256", NULL);
+#else
+  mds[CHUNK_HASH_SHA1] = EVP_sha1();
+  mds[CHUNK_HASH_SHA256] = EVP_sha256();
+  mds[CHUNK_HASH_BLAKE2S] = EVP_blake2s256();
+#endif
+}
+
+static const EVP_MD *get_md(unsigned type)
+{
+  pthread_once(&mds_once, fetch_mds);
+  if (type >= CHUNK_HASH_TYPES || mds[type] == NULL) {
+    fprintf(stderr, "chunk_hash: hash type %u is not available\n", type);
+    abort();
+  }
+  return mds[type];
+}
+
+const char *chunk_hash_name(unsigned type)
+{
+  return type < CHUNK_HASH_TYPES ? names[type] : NULL;
+}
+
+int chunk_hash_lookup(const char *name)
+{
+  int i;
+
+  for (i = 0; i < CHUNK_HASH_TYPES; i++) {
+    if (strcmp(name, names[i]) == 0) return i;
+  }
+  return -1;
+}
+
+chunk_hash_ctx *chunk_hash_new(unsigned type)
+{
+  chunk_hash_ctx *c = (chunk_hash_ctx *) malloc(sizeof(chunk_hash_ctx));
+
+  if (c == NULL || (c->ctx = EVP_MD_CTX_new()) == NULL) {
+    perror("chunk_hash_new");
+    exit(1);
+  }
+  c->md = get_md(type);
+  if (EVP_DigestInit_ex(c->ctx, c->md, NULL) != 1) {
+    fprintf(stderr, "chunk_hash_new: EVP_DigestInit_ex failed\n");
+    abort();
+  }
+  return c;
+}
+
+void chunk_hash_update(chunk_hash_ctx *c, const void *data, size_t len)
+{
+  EVP_DigestUpdate(c->ctx, data, len);
+}
+
+void chunk_hash_final(chunk_hash_ctx *c, unsigned char *digest)
+{
+  unsigned char full[EVP_MAX_MD_SIZE];
+
+  EVP_DigestFinal_ex(c->ctx, full, NULL);
+  memcpy(digest, full, CHUNK_HASH_LEN);
+  EVP_DigestInit_ex(c->ctx, c->md, NULL);
+}
+
+void chunk_hash_copy(chunk_hash_ctx *to, const chunk_hash_ctx *from)
+{
+  to->md = from->md;
+  if (EVP_MD_CTX_copy_ex(to->ctx, from->ctx) != 1) {
+    fprintf(stderr, "chunk_hash_copy: EVP_MD_CTX_copy_ex failed\n");
+    abort();
+  }
+}
+
+void chunk_hash_free(chunk_hash_ctx *c)
+{
+  if (c == NULL) return;
+  EVP_MD_CTX_free(c->ctx);
+  free(c);
+}
+
+void chunk_hash(unsigned type, const void *data, size_t len, unsigned char *digest)
+{
+  unsigned char full[EVP_MAX_MD_SIZE];
+
+  if (EVP_Digest(data, len, full, NULL, get_md(type), NULL) != 1) {
+    fprintf(stderr, "chunk_hash: EVP_Digest failed\n");
+    abort();
+  }
+  memcpy(digest, full, CHUNK_HASH_LEN);
+}
+
+struct blocks_work {
+  unsigned type;
+  size_t block_size;
+  const struct chunk_hash_job *jobs;
+  int njobs;
+  pthread_mutex_t mutex;
+  int job;          /* the next block to hash, protected by mutex */
+  size_t block;
+};
+
+static void *hash_blocks(void *arg)
+{
+  struct blocks_work *w = (struct blocks_work *) arg;
+  const struct chunk_hash_job *j;
+  size_t b, off, amt;
+
+  while (1) {
+    pthread_mutex_lock(&w->mutex);
+    while (w->job < w->njobs && w->block * w->block_size >= w->jobs[w->job].len) {
+      w->job++;
+      w->block = 0;
+    }
+    if (w->job == w->njobs) {
+      pthread_mutex_unlock(&w->mutex);
+      return NULL;
+    }
+    j = &w->jobs[w->job];
+    b = w->block++;
+    pthread_mutex_unlock(&w->mutex);
+
+    off = b * w->block_size;
+    amt = j->len - off > w->block_size ? w->block_size : j->len - off;
+    chunk_hash(w->type, j->data + off, amt, j->digests + CHUNK_HASH_LEN * b);
+  }
+}
+
+void chunk_hash_blocks(unsigned type, size_t block_size,
+                       const struct chunk_hash_job *jobs, int njobs, int max_threads)
+{
+  struct blocks_work w;
+  pthread_t threads[CHUNK_HASH_MAX_THREADS];
+  size_t total = 0, nblocks = 0;
+  int i, nthreads, started = 0;
+
+  for (i = 0; i < njobs; i++) {
+    total += jobs[i].len;
+    nblocks += (jobs[i].len + block_size - 1) / block_size;
+  }
+  if (max_threads <= 0) max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (max_threads > CHUNK_HASH_MAX_THREADS) max_threads = CHUNK_HASH_MAX_THREADS;
+  nthreads = (int) (total / CHUNK_HASH_THREAD_BYTES);
+  if (nthreads > max_threads) nthreads = max_threads;
+  if ((size_t) nthreads > nblocks) nthreads = (int) nblocks;
+
+  w.type = type;
+  w.block_size = block_size;
+  w.jobs = jobs;
+  w.njobs = njobs;
+  w.job = 0;
+  w.block = 0;
+  get_md(type); /* fail here rather than on a thread */
+  pthread_mutex_init(&w.mutex, NULL);
+  /* this thread is one of them; if a thread can't be started the
+     others just do more */
+  for (i = 1; i < nthreads; i++) {
+    if (pthread_create(&threads[started], NULL, hash_blocks, &w) == 0) started++;
+  }
+  hash_blocks(&w);
+  for (i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_mutex_destroy(&w.mutex);
+}
@@ -0,0 +1,61 @@
+/*
+   (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+
+   The hashes in chunk files (see header.h): SHA1 up to version 3,
+   and for version 4 whichever hash header_v2.hash_type names, cut
+   down to the 20 bytes the formats have room for.  Everything goes
+   through the OpenSSL EVP interface, so each hash gets whatever
+   implementation the library has for the CPU (SHA-NI for SHA1 and
+   SHA-256, SIMD for BLAKE2s).
+*/
+
+#ifndef CHUNK_HASH_H
+#define CHUNK_HASH_H
+
+#include <stddef.h>
+
+/* header_v2.hash_type */
+#define CHUNK_HASH_SHA1 0
+#define CHUNK_HASH_SHA256 1
+#define CHUNK_HASH_BLAKE2S 2
+#define CHUNK_HASH_TYPES 3
+
+#define CHUNK_HASH_LEN 20
+
+/* "sha1", "sha256" or "blake2s"; NULL if type is unknown */
+extern const char *chunk_hash_name(unsigned type);
+/* The type for a name, or -1 */
+extern int chunk_hash_lookup(const char *name);
+
+typedef struct chunk_hash_ctx chunk_hash_ctx;
+
+/* A running hash; aborts on an unknown type, so check the header first */
+extern chunk_hash_ctx *chunk_hash_new(unsigned type);
+extern void chunk_hash_update(chunk_hash_ctx *ctx, const void *data, size_t len);
+/* Writes CHUNK_HASH_LEN bytes to digest and starts the hash over */
+extern void chunk_hash_final(chunk_hash_ctx *ctx, unsigned char *digest);
+extern void chunk_hash_copy(chunk_hash_ctx *to, const chunk_hash_ctx *from);
+extern void chunk_hash_free(chunk_hash_ctx *ctx);
+
+extern void chunk_hash(unsigned type, const void *data, size_t len,
+                       unsigned char *digest);
+
+/* Hashes several buffers block by block, as for the block hash
+   tables: job i gets one digest per block_size bytes of its data
+   (the last block may be short) written to its digests.  OpenSSL has
+   no public multi-buffer digest interface, so the lanes are threads;
+   the blocks of all the jobs are shared out among up to max_threads
+   (0 for one per CPU) once there is enough work to be worth it. */
+struct chunk_hash_job {
+  const unsigned char *data;
+  size_t len;
+  unsigned char *digests;
+};
+
+extern void chunk_hash_blocks(unsigned type, size_t block_size,
+                              const struct chunk_hash_job *jobs, int njobs,
+                              int max_threads);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+   (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+
+   Reading side of the chunk index; see chunk_index.h.  The writer is
+   rs_index.
+*/
+
+#include <string.h>
+
+#include <openssl/sha.h>
+
+#include "chunk_index.h"
+
+void chunk_index_path_hash(const char *path, unsigned char *hash)
+{
+  unsigned char digest[20];
+
+  SHA1((const unsigned char *) path, strlen(path), digest);
+  memcpy(hash, digest, 16);
+}
+
+int chunk_index_compare(const void *a, const void *b)
+{
+  return memcmp(((const struct chunk_index_entry *) a)->path_hash,
+                ((const struct chunk_index_entry *) b)->path_hash, 16);
+}
+
+const struct chunk_index_entry *
+chunk_index_entries(const void *base, uint64_t len, uint64_t *nentries)
+{
+  const struct chunk_index_header *h = (const struct chunk_index_header *) base;
+
+  if (len < sizeof(*h) || memcmp(h->magic, CHUNK_INDEX_MAGIC, 8) != 0 ||
+      h->entry_size != sizeof(struct chunk_index_entry) ||
+      h->nentries > (len - sizeof(*h)) / sizeof(struct chunk_index_entry)) {
+    return NULL;
+  }
+  *nentries = h->nentries;
+  return (const struct chunk_index_entry *) (h + 1);
+}
+
+const struct chunk_index_entry *
+chunk_index_find(const struct chunk_index_entry *entries, uint64_t nentries,
+                 const unsigned char *path_hash)
+{
+  uint64_t lo = 0, hi = nentries;
+  int c;
+
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    c = memcmp(entries[mid].path_hash, path_hash, 16);
+    if (c == 0) return &entries[mid];
+    if (c < 0) lo = mid + 1; else hi = mid;
+  }
+  return NULL;
+}
+
+int chunk_content_compare(const void *a, const void *b)
+{
+  const struct chunk_content_entry *x = (const struct chunk_content_entry *) a;
+  const struct chunk_content_entry *y = (const struct chunk_content_entry *) b;
+
+  if (x->orig_size != y->orig_size) return x->orig_size < y->orig_size ? -1 : 1;
+  return memcmp(x->file_hash, y->file_hash, 20);
+}
+
+const struct chunk_content_entry *
+chunk_content_entries(const void *base, uint64_t len, uint64_t *nentries,
+                      const char **paths)
+{
+  const struct chunk_content_header *h = (const struct chunk_content_header *) base;
+  const struct chunk_content_entry *entries = (const struct chunk_content_entry *) (h + 1);
+  uint64_t i;
+
+  if (len < sizeof(*h) || memcmp(h->magic, CHUNK_CONTENT_MAGIC, 8) != 0 ||
+      h->entry_size != sizeof(struct chunk_content_entry) ||
+      h->nentries > (len - sizeof(*h)) / sizeof(struct chunk_content_entry) ||
+      h->paths_size != len - sizeof(*h) - h->nentries * sizeof(struct chunk_content_entry)) {
+    return NULL;
+  }
+  *paths = (const char *) (entries + h->nentries);
+  if (h->paths_size > 0 && (*paths)[h->paths_size - 1] != '\0') {
+    return NULL;
+  }
+  for (i = 0; i < h->nentries; i++) {
+    if (entries[i].path_offset >= h->paths_size) return NULL;
+  }
+  *nentries = h->nentries;
+  return entries;
+}
+
+const struct chunk_content_entry *
+chunk_content_find(const struct chunk_content_entry *entries, uint64_t nentries,
+                   uint64_t orig_size, const unsigned char *file_hash)
+{
+  uint64_t lo = 0, hi = nentries;
+
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (entries[mid].orig_size < orig_size ||
+        (entries[mid].orig_size == orig_size && file_hash != NULL &&
+         memcmp(entries[mid].file_hash, file_hash, 20) < 0)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == nentries || entries[lo].orig_size != orig_size ||
+      (file_hash != NULL && memcmp(entries[lo].file_hash, file_hash, 20) != 0)) {
+    return NULL;
+  }
+  return &entries[lo];
+}
@@ -0,0 +1,92 @@
+// Per-eccdir index of the chunks (and directories) under it, kept in
+// <eccdir>/.eccfs-index so that eccfs can tell which eccdirs hold a
+// file without probing every one of them.  The file is a struct
+// chunk_index_header followed by entries sorted by path hash; it is
+// only ever replaced whole, by writing a new one and renaming it over
+// the old, so readers can simply mmap it.
+//
+// Paths are relative to the eccdir and start with '/'.  The path hash
+// is the first 16 bytes of SHA1(path).
+
+#ifndef GFLIB_CHUNK_INDEX_H
+#define GFLIB_CHUNK_INDEX_H
+
+#include <stdint.h>
+
+#define CHUNK_INDEX_NAME ".eccfs-index"
+#define CHUNK_INDEX_MAGIC "ECCIDX01"
+
+struct chunk_index_header {
+    char magic[8];          // CHUNK_INDEX_MAGIC, no NUL
+    uint32_t entry_size;    // sizeof(struct chunk_index_entry)
+    uint32_t reserved;
+    uint64_t nentries;
+    uint64_t built_at;      // time() of the last full scan
+};
+
+#define CHUNK_INDEX_FILE 0
+#define CHUNK_INDEX_DIR 1
+
+struct chunk_index_entry {
+    unsigned char path_hash[16];
+    uint64_t orig_size;           // of the whole file
+    unsigned char file_hash[20];  // from the chunk header
+    uint8_t type;                 // CHUNK_INDEX_FILE or CHUNK_INDEX_DIR
+    uint8_t n, m, chunknum;       // files only
+};
+
+// Next to each index, <eccdir>/.eccfs-content lists the same files
+// by content, so that a copy of one of them can be found and shared
+// rather than encoded again.  It is a struct chunk_content_header,
+// entries sorted by size and then file hash, and the paths the
+// entries point into, each NUL terminated.  Only files whose file
+// hash is a SHA1 (versions 1 to 3) are in it.  rs_index writes it
+// just before the index, and replaces it whole in the same way.
+
+#define CHUNK_CONTENT_NAME ".eccfs-content"
+#define CHUNK_CONTENT_MAGIC "ECCCNT01"
+
+struct chunk_content_header {
+    char magic[8];          // CHUNK_CONTENT_MAGIC, no NUL
+    uint32_t entry_size;    // sizeof(struct chunk_content_entry)
+    uint32_t reserved;
+    uint64_t nentries;
+    uint64_t paths_size;    // bytes of paths after the entries
+};
+
+struct chunk_content_entry {
+    uint64_t orig_size;
+    unsigned char file_hash[20];  // SHA1 of the whole file
+    uint32_t reserved;
+    uint64_t path_offset;         // into the paths
+};
+
+extern void chunk_index_path_hash(const char *path, unsigned char *hash);
+extern int chunk_index_compare(const void *a, const void *b);
+
+// Checks the header of a mapped index of len bytes; returns the
+// entries or NULL if it isn't a usable index.
+extern const struct chunk_index_entry *
+chunk_index_entries(const void *base, uint64_t len, uint64_t *nentries);
+
+extern const struct chunk_index_entry *
+chunk_index_find(const struct chunk_index_entry *entries, uint64_t nentries,
+                 const unsigned char *path_hash);
+
+// By size, then file hash
+extern int chunk_content_compare(const void *a, const void *b);
+
+// Checks a mapped content table of len bytes; returns the entries,
+// with *paths pointing at the paths, or NULL if it isn't usable.
+extern const struct chunk_content_entry *
+chunk_content_entries(const void *base, uint64_t len, uint64_t *nentries,
+                      const char **paths);
+
+// The first entry of this size and file hash, or with file_hash NULL
+// just of this size; NULL if there is none.  The rest that match
+// follow it.
+extern const struct chunk_content_entry *
+chunk_content_find(const struct chunk_content_entry *entries, uint64_t nentries,
+                   uint64_t orig_size, const unsigned char *file_hash);
+
+#endif
@@ -0,0 +1,17 @@
+// Where things are in a chunk file; see chunk_layout_from_size in
+// header.h.  This is apart from header.h so that eccfs, which has a
+// struct header of its own (ChunkHeader.H), can share it.
+
+#ifndef GFLIB_CHUNK_LAYOUT_H
+#define GFLIB_CHUNK_LAYOUT_H
+
+struct chunk_layout {
+    unsigned long long blocksize;   // bytes of chunk data
+    unsigned long long data_offset; // where the chunk data starts
+    unsigned long long nhashblocks; // entries in the block hash table (version 2)
+    unsigned hash_block_size;       // 0 for version 1
+    unsigned long long stripe_unit; // 0 unless striped (version 3 or 4)
+    unsigned hash_type;             // CHUNK_HASH_SHA1 unless version 4
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+   (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+
+   Fused GF(2^8) multiply and add over a region: to_modify ^= factor *
+   to_add.  Unlike gf_mult_region followed by gf_add_parity this
+   leaves to_add alone and makes a single pass over memory.
+
+   The product of factor and a byte b is split on the nibbles of b,
+   factor*b = factor*(b & 0xf) ^ factor*(b & 0xf0), so two 16 entry
+   tables per factor cover every byte; with pshufb each table lookup
+   does 16, 32 or 64 bytes at once.  The widest kernel the CPU
+   supports is picked on first use; the scalar one is the fallback
+   and the reference gf_region_test checks the others against.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gflib.h"
+
+#ifndef W_8
+#error "gf_region.c only supports W_8"
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GF_REGION_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*region_fn)(const unsigned char *to_add, unsigned char *to_modify,
+                          int size, int factor);
+
+static unsigned char mul_table[256][256];
+static unsigned char nibble_lo[256][16] __attribute__((aligned(16)));
+static unsigned char nibble_hi[256][16] __attribute__((aligned(16)));
+static int tables_ready = 0;
+static region_fn gf_region_fn = NULL;
+static const char *gf_region_name = NULL;
+
+static void region_scalar(const unsigned char *to_add, unsigned char *to_modify,
+                          int size, int factor)
+{
+  const unsigned char *row = mul_table[factor];
+  int i;
+
+  for (i = 0; i < size; i++) {
+    to_modify[i] ^= row[to_add[i]];
+  }
+}
+
+#ifdef GF_REGION_X86
+__attribute__((target("ssse3")))
+static void region_ssse3(const unsigned char *to_add, unsigned char *to_modify,
+                         int size, int factor)
+{
+  __m128i lo = _mm_load_si128((const __m128i *) nibble_lo[factor]);
+  __m128i hi = _mm_load_si128((const __m128i *) nibble_hi[factor]);
+  __m128i mask = _mm_set1_epi8(0x0f);
+  int i;
+
+  for (i = 0; i + 16 <= size; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i *) (to_add + i));
+    __m128i p = _mm_xor_si128(
+        _mm_shuffle_epi8(lo, _mm_and_si128(s, mask)),
+        _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+    __m128i *d = (__m128i *) (to_modify + i);
+    _mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(d), p));
+  }
+  region_scalar(to_add + i, to_modify + i, size - i, factor);
+}
+
+__attribute__((target("avx2")))
+static void region_avx2(const unsigned char *to_add, unsigned char *to_modify,
+                        int size, int factor)
+{
+  __m256i lo = _mm256_broadcastsi128_si256(
+      _mm_load_si128((const __m128i *) nibble_lo[factor]));
+  __m256i hi = _mm256_broadcastsi128_si256(
+      _mm_load_si128((const __m128i *) nibble_hi[factor]));
+  __m256i mask = _mm256_set1_epi8(0x0f);
+  int i;
+
+  for (i = 0; i + 32 <= size; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i *) (to_add + i));
+    __m256i p = _mm256_xor_si256(
+        _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask)),
+        _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+    __m256i *d = (__m256i *) (to_modify + i);
+    _mm256_storeu_si256(d, _mm256_xor_si256(_mm256_loadu_si256(d), p));
+  }
+  region_ssse3(to_add + i, to_modify + i, size - i, factor);
+}
+
+#if __GNUC__ >= 5
+#define GF_REGION_AVX512 1
+__attribute__((target("avx512f,avx512bw")))
+static void region_avx512(const unsigned char *to_add, unsigned char *to_modify,
+                          int size, int factor)
+{
+  __m512i lo = _mm512_broadcast_i32x4(
+      _mm_load_si128((const __m128i *) nibble_lo[factor]));
+  __m512i hi = _mm512_broadcast_i32x4(
+      _mm_load_si128((const __m128i *) nibble_hi[factor]));
+  __m512i mask = _mm512_set1_epi8(0x0f);
+  int i;
+
+  for (i = 0; i + 64 <= size; i += 64) {
+    __m512i s = _mm512_loadu_si512((const void *) (to_add + i));
+    __m512i p = _mm512_xor_si512(
+        _mm512_shuffle_epi8(lo, _mm512_and_si512(s, mask)),
+        _mm512_shuffle_epi8(hi, _mm512_and_si512(_mm512_srli_epi64(s, 4), mask)));
+    void *d = (void *) (to_modify + i);
+    _mm512_storeu_si512(d, _mm512_xor_si512(_mm512_loadu_si512(d), p));
+  }
+  region_avx2(to_add + i, to_modify + i, size - i, factor);
+}
+#endif
+#endif
+
+static struct {
+  const char *name;
+  region_fn fn;
+} kernels[] = {
+  /* best first */
+#ifdef GF_REGION_AVX512
+  { "avx512", region_avx512 },
+#endif
+#ifdef GF_REGION_X86
+  { "avx2", region_avx2 },
+  { "ssse3", region_ssse3 },
+#endif
+  { "scalar", region_scalar },
+};
+static const int nkernels = sizeof(kernels) / sizeof(kernels[0]);
+
+static int kernel_supported(const char *name)
+{
+#ifdef GF_REGION_X86
+  __builtin_cpu_init();
+  if (strcmp(name, "avx512") == 0) {
+    /* the tail is done by the avx2 kernel */
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+      && __builtin_cpu_supports("avx2");
+  }
+  if (strcmp(name, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("ssse3");
+  }
+  if (strcmp(name, "ssse3") == 0) {
+    return __builtin_cpu_supports("ssse3");
+  }
+#endif
+  return strcmp(name, "scalar") == 0;
+}
+
+static void setup_tables()
+{
+  int f, b;
+
+  if (tables_ready) return;
+  gf_modar_setup();
+  for (f = 0; f < 256; f++) {
+    for (b = 0; b < 256; b++) {
+      mul_table[f][b] = gf_single_multiply(f, b);
+    }
+    for (b = 0; b < 16; b++) {
+      nibble_lo[f][b] = mul_table[f][b];
+      nibble_hi[f][b] = mul_table[f][b << 4];
+    }
+  }
+  tables_ready = 1;
+}
+
+/* Builds the tables and picks a kernel; like gf_modar_setup it is
+   not locked, so threaded callers should call it before starting
+   threads. */
+void gf_region_setup()
+{
+  int i;
+  const char *forced;
+
+  if (gf_region_fn != NULL) return;
+  setup_tables();
+
+  /* GF_REGION_KERNEL=name overrides the choice, e.g. for timing */
+  forced = getenv("GF_REGION_KERNEL");
+  if (forced != NULL && gf_region_set_kernel(forced)) return;
+  for (i = 0; i < nkernels; i++) {
+    if (kernel_supported(kernels[i].name)) {
+      gf_region_name = kernels[i].name;
+      gf_region_fn = kernels[i].fn;
+      return;
+    }
+  }
+}
+
+int gf_region_set_kernel(const char *name)
+{
+  int i;
+
+  setup_tables();
+  for (i = 0; i < nkernels; i++) {
+    if (strcmp(name, kernels[i].name) == 0 && kernel_supported(name)) {
+      gf_region_name = kernels[i].name;
+      gf_region_fn = kernels[i].fn;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+const char *gf_region_kernel()
+{
+  gf_region_setup();
+  return gf_region_name;
+}
+
+const char *gf_region_kernel_names(int i)
+{
+  return i >= 0 && i < nkernels ? kernels[i].name : NULL;
+}
+
+void gf_mult_region_add(const void *to_add, void *to_modify, int size, int factor)
+{
+  if (size <= 0 || factor == 0) return;
+  gf_region_setup();
+  gf_region_fn((const unsigned char *) to_add, (unsigned char *) to_modify,
+               size, factor);
+}
@@ -0,0 +1,104 @@
+/*
+   (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+
+   Checks that every gf_mult_region_add kernel this CPU supports
+   gives the same answer as gf_single_multiply for every factor over
+   a spread of sizes and alignments, then times each of them.
+
+   usage: gf_region_test [-t]   (-t: skip the timing)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "gflib.h"
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1.0e6;
+}
+
+static int check_kernel(const char *name)
+{
+  static const int sizes[] = { 1, 2, 15, 16, 17, 31, 32, 33, 63, 64, 65,
+                               127, 128, 129, 255, 1000, 4099 };
+  const int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+  unsigned char src[4099 + 8], dst[4099 + 8], expect[4099 + 8];
+  int factor, s, src_off, dst_off, i, errors = 0;
+
+  for (factor = 0; factor < 256; factor++) {
+    for (s = 0; s < nsizes; s++) {
+      for (src_off = 0; src_off < 4; src_off++) {
+        for (dst_off = 0; dst_off < 4; dst_off += 3) {
+          int size = sizes[s];
+          for (i = 0; i < size + 8; i++) {
+            src[i] = random();
+            dst[i] = expect[i] = random();
+          }
+          for (i = 0; i < size; i++) {
+            expect[dst_off + i] ^= gf_single_multiply(factor, src[src_off + i]);
+          }
+          gf_mult_region_add(src + src_off, dst + dst_off, size, factor);
+          if (memcmp(dst, expect, size + 8) != 0) {
+            if (errors++ < 10) {
+              fprintf(stderr, "%s: mismatch factor %d size %d offsets %d/%d\n",
+                      name, factor, size, src_off, dst_off);
+            }
+          }
+        }
+      }
+    }
+  }
+  return errors;
+}
+
+static void time_kernel(const char *name)
+{
+  const int size = 1024*1024, passes = 256;
+  unsigned char *src = malloc(size), *dst = malloc(size);
+  double start;
+  int i;
+
+  if (src == NULL || dst == NULL) { perror("malloc"); exit(1); }
+  for (i = 0; i < size; i++) {
+    src[i] = random();
+    dst[i] = random();
+  }
+  start = now();
+  for (i = 0; i < passes; i++) {
+    gf_mult_region_add(src, dst, size, 1 + i % 255);
+  }
+  printf("%-8s %8.1f MB/s\n", name, (double)size * passes / (1024*1024) / (now() - start));
+  free(src);
+  free(dst);
+}
+
+int main(int argc, char **argv)
+{
+  const char *name;
+  int i, errors = 0;
+  int timing = !(argc > 1 && strcmp(argv[1], "-t") == 0);
+
+  srandom(1);
+  gf_region_setup();
+  printf("default kernel: %s\n", gf_region_kernel());
+  for (i = 0; (name = gf_region_kernel_names(i)) != NULL; i++) {
+    if (!gf_region_set_kernel(name)) {
+      printf("%-8s not supported here\n", name);
+      continue;
+    }
+    errors += check_kernel(name);
+    if (timing) time_kernel(name);
+  }
+  if (errors > 0) {
+    fprintf(stderr, "%d mismatches\n", errors);
+    exit(1);
+  }
+  printf("all kernels agree\n");
+  return 0;
+}
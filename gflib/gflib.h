@@ -57,6 +57,12 @@ extern void gf_fprint_matrix(FILE *f, int *m, int rows, int cols);
 extern void gf_fast_add_parity(void *to_add, void *to_modify, int size);
 extern void gf_add_parity(void *to_add, void *to_modify, int size);
 extern void gf_mult_region(void *region, int size, int factor);
+/* gf_region.c: to_modify ^= factor * to_add, any alignment */
+extern void gf_mult_region_add(const void *to_add, void *to_modify, int size, int factor);
+extern void gf_region_setup();
+extern int gf_region_set_kernel(const char *name); /* 0 if not supported here */
+extern const char *gf_region_kernel();
+extern const char *gf_region_kernel_names(int i);  /* NULL past the last one */
 extern int gf_log(int value);
 extern int *gf_make_vandermonde(int rows, int cols);
 extern int *gf_make_dispersal_matrix(int rows, int cols);
@@ -5,6 +5,40 @@
 
 // File hash verifies the underlying data of the file
 
+// Version 1 chunk files are the header followed by the chunk data.
+// Both chunk hashes are calculated from SHA1(data), so a chunk can only
+// be verified by reading all of it.
+//
+// Version 2 chunk files are the header, a struct header_v2, a table
+// of SHA1(block) for each 2^hash_block_shift byte block of the chunk
+// data (the last block may be short), and then the data.  Everywhere
+// version 1 uses SHA1(data), version 2 uses SHA1(header_v2, table),
+// so the chunk hash verifies the table and the table verifies each
+// block; readers only have to hash the blocks they touch.
+//
+// Version 3 chunk files are laid out like version 2, but the file is
+// striped across the data chunks in 2^stripe_shift byte units: the
+// file goes unit 0 of chunk 0, unit 0 of chunk 1, ... unit 0 of
+// chunk n-1, unit 1 of chunk 0, and so on, so a sequential read
+// touches all the data chunks in turn.  If the chunk data isn't a
+// whole number of units the last row of the stripe uses the leftover
+// (blocksize % unit) bytes of each chunk as its unit.  The chunk data
+// and the hashes are the same as version 2 given the same chunk
+// contents; chunk_locate and chunk_file_offset do the mapping.
+//
+// Version 4 chunk files are laid out like version 3, or like version
+// 2 if stripe_shift is 0, but every hash in them -- the block table,
+// the chunk, crosschunk and file hashes -- is the hash named by
+// header_v2.hash_type truncated to 20 bytes, so SHA1 can be swapped
+// for something faster on current CPUs without moving anything.
+// Version 1 to 3 chunks always use SHA1.  See chunk_hash.h.
+
+#ifndef GFLIB_HEADER_H
+#define GFLIB_HEADER_H
+
+#include "chunk_hash.h"
+#include "chunk_layout.h"
+
 struct header {
     unsigned char version;
     unsigned char under_size;
@@ -16,26 +50,36 @@ struct header {
     // crosschunk_hash = SHA1(header_incl_file_hash[0], SHA1(chunk_data[0]), ...)
     unsigned char sha1_crosschunk_hash[20]; 
     // chunk_hash calculated as SHA1(header,SHA1(data))
-    // This is done because the ecc calculation destroys the underlying data
-    // buffers
+    // This is done so SHA1(data) can be kept running while the data is
+    // written out; the header is filled in last
     unsigned char sha1_chunk_hash[20];
 };
 
+struct header_v2 {
+    unsigned char hash_block_shift; // log2 of the data covered by each table entry
+    unsigned char stripe_shift;     // version 3: log2 of the stripe unit; else 0
+    unsigned char hash_type;        // version 4: CHUNK_HASH_*; else 0
+    unsigned char reserved[5];      // must be zero
+};
+
+#define HEADER_HASH_BLOCK_SHIFT_DEFAULT 16
+#define HEADER_STRIPE_SHIFT_DEFAULT 20
+
 // no worries about bit field ordering if we do this...
-inline unsigned getn(struct header *h) {
+static inline unsigned getn(struct header *h) {
     return (h->n_m_chunknum_a >> 3) & 0x1F;
 }
 
-inline unsigned getm(struct header *h) {
+static inline unsigned getm(struct header *h) {
     return ((h->n_m_chunknum_a & 0x07) << 2) |
 	((h->n_m_chunknum_b >> 6) & 0x03);
 }
 
-inline unsigned getchunknum(struct header *h) {
+static inline unsigned getchunknum(struct header *h) {
     return h->n_m_chunknum_b & 0x3F;
 }
 
-inline void setnmchunknum(struct header *h, unsigned n, 
+static inline void setnmchunknum(struct header *h, unsigned n, 
 			 unsigned m, unsigned chunknum) {
     if (n > 31 || m > 31 || chunknum > n + m) {
 	fprintf(stderr,"internal %d %d %d\n", n,m,chunknum);
@@ -50,3 +94,126 @@ inline void setnmchunknum(struct header *h, unsigned n,
     }
 }
 
+
+static inline unsigned long long 
+chunk_nhashblocks(unsigned long long blocksize, unsigned hash_block_shift) {
+    return (blocksize + (1ULL << hash_block_shift) - 1) >> hash_block_shift;
+}
+
+// Size of the chunk file that holds blocksize bytes of chunk data
+static inline unsigned long long 
+chunk_file_size(unsigned version, unsigned hash_block_shift, 
+		unsigned long long blocksize) {
+    if (version == 1) {
+	return sizeof(struct header) + blocksize;
+    }
+    return sizeof(struct header) + sizeof(struct header_v2) 
+	+ 20 * chunk_nhashblocks(blocksize, hash_block_shift) + blocksize;
+}
+
+// For versions 2 to 4; stripe units are whole hash blocks
+static inline int 
+header_v2_valid(unsigned version, struct header_v2 *ext) {
+    int i;
+    if (ext->hash_block_shift < 9 || ext->hash_block_shift > 30) {
+	return 0;
+    }
+    if (version == 3 || (version == 4 && ext->stripe_shift != 0) 
+	? (ext->stripe_shift < ext->hash_block_shift || ext->stripe_shift > 30) 
+	: ext->stripe_shift != 0) {
+	return 0;
+    }
+    if (version == 4 ? ext->hash_type >= CHUNK_HASH_TYPES : ext->hash_type != 0) {
+	return 0;
+    }
+    for(i = 0; i < (int)sizeof(ext->reserved); ++i) {
+	if (ext->reserved[i] != 0) return 0;
+    }
+    return 1;
+}
+
+// Inverse of chunk_file_size; ext is ignored for version 1 chunks.
+// Returns 0 if the file size is impossible for the header.
+static inline int 
+chunk_layout_from_size(struct header *h, struct header_v2 *ext,
+		       unsigned long long file_size, struct chunk_layout *l) {
+    unsigned long long per_block, nblocks;
+
+    if (h->version == 1) {
+	if (file_size < sizeof(struct header)) return 0;
+	l->blocksize = file_size - sizeof(struct header);
+	l->data_offset = sizeof(struct header);
+	l->nhashblocks = 0;
+	l->hash_block_size = 0;
+	l->stripe_unit = 0;
+	l->hash_type = CHUNK_HASH_SHA1;
+	return 1;
+    }
+    if (h->version < 2 || h->version > 4 || !header_v2_valid(h->version, ext)) {
+	return 0;
+    }
+    if (file_size < sizeof(struct header) + sizeof(struct header_v2)) {
+	return 0;
+    }
+    file_size -= sizeof(struct header) + sizeof(struct header_v2);
+    per_block = (1ULL << ext->hash_block_shift) + 20;
+    nblocks = (file_size + per_block - 1) / per_block;
+    l->blocksize = file_size - 20 * nblocks;
+    l->nhashblocks = nblocks;
+    l->data_offset = sizeof(struct header) + sizeof(struct header_v2) + 20 * nblocks;
+    l->hash_block_size = 1U << ext->hash_block_shift;
+    l->stripe_unit = ext->stripe_shift != 0 ? 1ULL << ext->stripe_shift : 0;
+    l->hash_type = ext->hash_type;
+    return chunk_nhashblocks(l->blocksize, ext->hash_block_shift) == nblocks;
+}
+
+// Where byte pos of the file is: data chunk *chunknum, at
+// *chunk_offset in its data.  Returns how many bytes from pos on are
+// contiguous in that chunk.  pos has to be < n * blocksize.
+static inline unsigned long long
+chunk_locate(const struct chunk_layout *l, unsigned n, unsigned long long pos,
+	     unsigned *chunknum, unsigned long long *chunk_offset) {
+    unsigned long long unit = l->stripe_unit, full_rows, row_unit, within;
+
+    if (unit == 0 || unit > l->blocksize) {
+	unit = l->blocksize;
+    }
+    full_rows = l->blocksize / unit;
+    if (pos < full_rows * n * unit) {
+	row_unit = unit;
+	within = pos % (n * unit);
+	*chunk_offset = pos / (n * unit) * unit;
+    } else {
+	row_unit = l->blocksize - full_rows * unit;
+	within = pos - full_rows * n * unit;
+	*chunk_offset = full_rows * unit;
+    }
+    *chunknum = within / row_unit;
+    *chunk_offset += within % row_unit;
+    return row_unit - within % row_unit;
+}
+
+// Inverse of chunk_locate: the file offset of chunk_offset in data
+// chunk chunknum; *run gets how many bytes from there on are
+// contiguous in the file.
+static inline unsigned long long
+chunk_file_offset(const struct chunk_layout *l, unsigned n, unsigned chunknum,
+		  unsigned long long chunk_offset, unsigned long long *run) {
+    unsigned long long unit = l->stripe_unit, full_rows, row_unit, within;
+
+    if (unit == 0 || unit > l->blocksize) {
+	unit = l->blocksize;
+    }
+    full_rows = l->blocksize / unit;
+    if (chunk_offset < full_rows * unit) {
+	within = chunk_offset % unit;
+	*run = unit - within;
+	return chunk_offset / unit * n * unit + chunknum * unit + within;
+    }
+    row_unit = l->blocksize - full_rows * unit;
+    within = chunk_offset - full_rows * unit;
+    *run = row_unit - within;
+    return full_rows * n * unit + chunknum * row_unit + within;
+}
+
+#endif
@@ -0,0 +1,128 @@
+/*
+   (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gflib.h"
+#include "rs_codec.h"
+
+/* Outputs are built a strip at a time so the piece of each output
+   being accumulated stays in cache while all the inputs are added */
+#define RS_STRIP_SIZE (64*1024)
+
+struct rs_decoder {
+  int n, m;
+  int *sources;      /* n chunk numbers */
+  int *coefficients; /* (n+m) x n; row c rebuilds chunk c */
+};
+
+/* out[o] = sum over i of coef[o*nin + i] * in[i] */
+static void matrix_apply(const int *coef, const uint8_t **in, int nin,
+                         uint8_t **out, int nout, size_t len)
+{
+  size_t off, amt;
+  int o, i;
+
+  for (off = 0; off < len; off += amt) {
+    amt = len - off > RS_STRIP_SIZE ? RS_STRIP_SIZE : len - off;
+    for (o = 0; o < nout; o++) {
+      memset(out[o] + off, 0, amt);
+      for (i = 0; i < nin; i++) {
+        if (coef[o*nin + i] != 0) {
+          gf_mult_region_add(in[i] + off, out[o] + off, amt, coef[o*nin + i]);
+        }
+      }
+    }
+  }
+}
+
+void rs_encode(const uint8_t **data, uint8_t **parity, size_t len, int n, int m)
+{
+  int *vdm;
+
+  if (m == 0) return;
+  vdm = gf_make_dispersal_matrix(n + m, n);
+  /* the parity rows follow the n identity rows */
+  matrix_apply(vdm + n*n, data, n, parity, m, len);
+  free(vdm);
+}
+
+rs_decoder *rs_decoder_new(int n, int m, const int *present)
+{
+  rs_decoder *d;
+  Condensed_Matrix *cm;
+  int *vdm, *inv, *exists;
+  int c, i, k, sum;
+
+  exists = (int *) malloc(sizeof(int) * (n + m));
+  if (exists == NULL) { perror("rs_decoder_new - exists"); exit(1); }
+  for (i = 0; i < n + m; i++) exists[i] = present[i] != 0;
+
+  vdm = gf_make_dispersal_matrix(n + m, n);
+  cm = gf_condense_dispersal_matrix(vdm, exists, n + m, n);
+  free(exists);
+  if (cm == NULL) {
+    free(vdm);
+    return NULL;
+  }
+  inv = gf_invert_matrix(cm->condensed_matrix, n);
+  if (inv == NULL) {
+    fprintf(stderr, "rs_decoder_new: condensed matrix not invertible\n");
+    exit(1);
+  }
+
+  d = (rs_decoder *) malloc(sizeof(rs_decoder));
+  if (d == NULL) { perror("rs_decoder_new"); exit(1); }
+  d->n = n;
+  d->m = m;
+  d->sources = cm->row_identities;
+  d->coefficients = (int *) malloc(sizeof(int) * (n + m) * n);
+  if (d->coefficients == NULL) { perror("rs_decoder_new - coefficients"); exit(1); }
+
+  /* data chunks come straight from the inverse; a parity chunk is its
+     dispersal row applied to the recovered data */
+  memcpy(d->coefficients, inv, sizeof(int) * n * n);
+  for (c = n; c < n + m; c++) {
+    for (i = 0; i < n; i++) {
+      sum = 0;
+      for (k = 0; k < n; k++) {
+        sum ^= gf_single_multiply(vdm[c*n + k], inv[k*n + i]);
+      }
+      d->coefficients[c*n + i] = sum;
+    }
+  }
+
+  free(inv);
+  free(cm->condensed_matrix);
+  free(cm);
+  free(vdm);
+  return d;
+}
+
+void rs_decoder_free(rs_decoder *d)
+{
+  if (d == NULL) return;
+  free(d->sources);
+  free(d->coefficients);
+  free(d);
+}
+
+int rs_decoder_source(const rs_decoder *d, int i)
+{
+  return d->sources[i];
+}
+
+int rs_decoder_coefficient(const rs_decoder *d, int chunknum, int i)
+{
+  return d->coefficients[chunknum*d->n + i];
+}
+
+void rs_decode(const rs_decoder *d, const uint8_t **sources, int chunknum,
+               uint8_t *out, size_t len)
+{
+  matrix_apply(d->coefficients + chunknum*d->n, sources, d->n, &out, 1, len);
+}
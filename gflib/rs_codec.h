@@ -0,0 +1,41 @@
+/*
+   (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+
+   Reed-Solomon encode and decode over whole regions using the gflib
+   dispersal matrix (W_8).  The inputs are only read, so callers can
+   hash or write them in the same pass; each output is built by one
+   matrix-times-vector pass with gf_mult_region_add.
+*/
+
+#ifndef RS_CODEC_H
+#define RS_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Computes the m parity chunks of n data chunks, each len bytes */
+extern void rs_encode(const uint8_t **data, uint8_t **parity, size_t len,
+                      int n, int m);
+
+typedef struct rs_decoder rs_decoder;
+
+/* A decoder for the case where the chunks with present[i] != 0,
+   0 <= i < n+m, are available; n of them are used, data chunks
+   first.  Returns NULL if fewer than n are present. */
+extern rs_decoder *rs_decoder_new(int n, int m, const int *present);
+extern void rs_decoder_free(rs_decoder *d);
+
+/* The chunk number rs_decode expects in sources[i], 0 <= i < n */
+extern int rs_decoder_source(const rs_decoder *d, int i);
+
+/* The coefficient of sources[i] when rebuilding chunknum; sources
+   with a zero coefficient are not read and may be NULL. */
+extern int rs_decoder_coefficient(const rs_decoder *d, int chunknum, int i);
+
+/* Rebuilds len bytes of chunk chunknum, data or parity, into out */
+extern void rs_decode(const rs_decoder *d, const uint8_t **sources,
+                      int chunknum, uint8_t *out, size_t len);
+
+#endif
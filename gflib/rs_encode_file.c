@@ -41,212 +41,85 @@ $Revision: 1.2 $
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
-#include "gflib.h"
-#include <sys/time.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
-#include <arpa/inet.h>
-#include <openssl/sha.h>
-
+#include "chunk_hash.h"
+#include "gflib.h"
 #include "header.h"
+#include "rs_stream.h"
 
-FILE *
-openFile(char *stem, int i)
-{
-    char buf_file[PATH_MAX]; 
-
-    FILE *f;
-    sprintf(buf_file, "%s-%04d.rs", stem, i);
-
-    f = fopen(buf_file, "w+");
-    if (f == NULL) { perror(buf_file); exit(1); }
-    int ret = fseek(f, 0, SEEK_SET);
-    return f;
-}
-
-void 
-writeBuffer(FILE *f, int i, struct header *header, 
-	    char *buffer, int blocksize)
+void
+usage()
 {
-    SHA_CTX ctx;
-    int ret;
-
-    printf("Writing buffer for fragment %d ...", i);
-    fflush(stdout);
-
-    SHA1_Init(&ctx);
-    // SHA1_Update(&ctx, header, offsetof(struct header, sha1_chunk_hash));
-    SHA1_Update(&ctx, buffer, blocksize);
-    // Not the final chunk hash, see header.h for explanation
-    SHA1_Final(header->sha1_chunk_hash, &ctx); 
-    
-    // eliminate valgrind warning; we will fix this later, but it's
-    // better to get a clean run
-    memset(header->sha1_crosschunk_hash, '\0', 20);
-
-    ret = fseek(f, 0, SEEK_SET);
-    if (ret != 0) { abort(); };
-    ret = fwrite(header, 1, sizeof(*header), f);
-    if (ret != sizeof(*header)) { perror("header write failed"); exit(1); }
-    ret = fwrite(buffer, 1, blocksize, f);
-    if (ret != blocksize) { perror("buffer write failed"); exit(1); }
-    printf(" Done\n");
+    fprintf(stderr, "usage: rs_encode_file [-v version] [-s stripe-shift] [-H hash] [-w window-KiB] filename n m stem\n");
+    exit(1);
 }
 
-/* This one is going to be in-core */
+/* Streams the file through rs_encode_stream; memory use is (n+m) windows */
 
 int
 main(int argc, char **argv)
 {
-  int i, j, *vdm, *inv, *prod, cache_size;
-  int rows, cols, blocksize, orig_size;
-  int n, m, sz, *factors, tmp, factor;
+  int i, n, m, rows, in_fd, *out_fds, opt;
   char *stem, *filename; 
-  char **buffer;
-  struct header *headers;
+  char buf_file[PATH_MAX]; 
   struct stat buf;
-  FILE **outfiles;
-  FILE *f;
-  SHA_CTX ctx;
-
-  if (argc != 5) {
-    fprintf(stderr, "usage: rs_encode_file filename n m stem\n");
-    exit(1);
+  struct rs_encode_params params;
+
+  memset(&params, 0, sizeof(params));
+  params.version = 2;
+  params.hash_block_shift = HEADER_HASH_BLOCK_SHIFT_DEFAULT;
+  params.stripe_shift = HEADER_STRIPE_SHIFT_DEFAULT;
+  params.hash_type = CHUNK_HASH_SHA256; /* version 4 */
+  while ((opt = getopt(argc, argv, "v:s:H:w:")) != -1) {
+    switch (opt) {
+    case 'v': params.version = atoi(optarg); break;
+    case 's': params.stripe_shift = atoi(optarg); break;
+    case 'H': params.hash_type = chunk_hash_lookup(optarg); break;
+    case 'w': params.window = (size_t) atoi(optarg) * 1024; break;
+    default: usage();
+    }
   }
+  if (argc - optind != 4 || params.version < 1 || params.version > 4 ||
+      params.hash_type < 0) {
+    usage();
+  }
+  argv += optind - 1;
   
-  n = atoi(argv[2]);
-  m = atoi(argv[3]);
-  stem = argv[4];
   filename = argv[1];
+  n = params.n = atoi(argv[2]);
+  m = params.m = atoi(argv[3]);
+  stem = argv[4];
+  rows = n + m;
 
-  rows = n+m;
-  cols = n;
-
-  if (stat(filename, &buf) != 0) {
+  in_fd = open(filename, O_RDONLY);
+  if (in_fd == -1 || fstat(in_fd, &buf) != 0) {
     perror(filename);
     exit(1);
   }
 
-  sz = buf.st_size;
-  orig_size = buf.st_size;
-  if (sz % (n*sizeof(unit)) != 0) {
-    sz += (n*sizeof(unit) - (sz % (n*sizeof(unit))));
-  }
-  blocksize = sz/n;
-
-  if ((sz - orig_size) < 0 || (sz - orig_size) > 255 || n > 255 || m > 255) {
-      fprintf(stderr, "Huh\n");
-      abort();
-  }
-
-  buffer = (char **) malloc(sizeof(char *)*rows);
-  if (buffer == NULL) abort();
-  headers = (struct header *)malloc(sizeof(struct header)*rows);
-
-  for(i = 0; i < rows; ++i) {
-      headers[i].version = 1;
-      headers[i].under_size = sz - orig_size;
-      setnmchunknum(headers+i, n, m, i);
-  }
-      
-  for (i = 0; i < n+1; i++) { // one extra buffer for all ecc calculations
-      buffer[i] = (char *) malloc(blocksize);
-      if (buffer[i] == NULL) {
-	  perror("Allocating buffer to store the whole file");
-	  exit(1);
-      }
-  }
-
-  f = fopen(filename, "r");
-  if (f == NULL) { perror(filename); }
-  cache_size = orig_size;
-
-  SHA1_Init(&ctx);
-  for (i = 0; i < n; i++) {
-      if (cache_size < blocksize) memset(buffer[i], 0, blocksize);
-      if (cache_size > 0) {
-	  int amt = (cache_size > blocksize) ? blocksize : cache_size;
-	  if (fread(buffer[i], 1, amt, f) <= 0) {
-	      fprintf(stderr, "Couldn't read the right bytes into the buffer\n");
-	      exit(1);
-	  }
-	  SHA1_Update(&ctx, buffer[i], amt);
-      }
-      cache_size -= blocksize;
-  }
-  fclose(f);
-  SHA1_Final(headers[0].sha1_file_hash, &ctx);
-  for(i = 1; i < rows; ++i) {
-      memcpy(headers[i].sha1_file_hash, headers[0].sha1_file_hash, 
-	     sizeof(headers[0].sha1_file_hash));
-  }
-
-  outfiles = malloc(sizeof(FILE *)*rows);
-  for(i=0; i < n; ++i) {
-      outfiles[i] = openFile(stem, i);
-      writeBuffer(outfiles[i], i, headers+i, buffer[i], blocksize);
-  }
-
-  factors = (int *) malloc(sizeof(int)*n);
-  if (factors == NULL) { perror("malloc - factors"); exit(1); }
-
-  for (i = 0; i < n; i++) factors[i] = 1;
-  
-  vdm = gf_make_dispersal_matrix(rows, cols);
-
-  for (i = cols; i < rows; i++) {
-      printf("Calculating parity fragment %d ...", i); fflush(stdout);
-      memset(buffer[n], 0, blocksize); 
-      for (j = 0; j < cols; j++) {
-	  tmp = vdm[i*cols+j]; 
-	  if (tmp != 0) {
-	      factor = gf_single_divide(tmp, factors[j]);
-	      factors[j] = tmp;
-	      gf_mult_region(buffer[j], blocksize, factor);
-	      gf_add_parity(buffer[j], buffer[n], blocksize);
-	  }
-      }
-      printf("done.\n");
-      outfiles[i] = openFile(stem, i);
-      writeBuffer(outfiles[i], i, headers+i, buffer[n], blocksize);
+  out_fds = (int *) malloc(sizeof(int) * rows);
+  if (out_fds == NULL) { perror("malloc - out_fds"); exit(1); }
+  for (i = 0; i < rows; i++) {
+    sprintf(buf_file, "%s-%04d.rs", stem, i);
+    out_fds[i] = open(buf_file, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (out_fds[i] == -1) { perror(buf_file); exit(1); }
   }
 
-  printf("Calculating final hashes and updating files...\n");
-  // calculate cross-chunk hash...
-
-  SHA1_Init(&ctx);
-  for(i=0; i<rows; ++i) {
-      SHA1_Update(&ctx, &headers[i], offsetof(struct header, sha1_crosschunk_hash));
-      SHA1_Update(&ctx, headers[i].sha1_chunk_hash, 20);
-  }
-  SHA1_Final(headers[0].sha1_crosschunk_hash, &ctx);
-  for(i=1; i<rows; ++i) {
-      memcpy(headers[i].sha1_crosschunk_hash, headers[0].sha1_crosschunk_hash, 20);
+  printf("Encoding %s (%lld bytes) n=%d m=%d ...", filename, 
+         (long long) buf.st_size, n, m);
+  fflush(stdout);
+  if (rs_encode_stream(in_fd, buf.st_size, &params, out_fds, NULL) != 0) {
+    exit(1);
   }
+  printf(" done.\n");
 
-  // calculate chunk hash, update header, close...
-  for(i=0; i<rows; ++i) {
-      int ret;
-
-      SHA1_Init(&ctx);
-      // SHA1(data) is in sha1_chunk_hash, so include it...
-      SHA1_Update(&ctx, &headers[i], sizeof(struct header));
-      SHA1_Final(headers[i].sha1_chunk_hash, &ctx);
-      
-      ret = fseek(outfiles[i], 0, SEEK_SET);
-      if (ret != 0) {
-	  perror("seek failed"); 
-	  exit(1); 
-      }	  
-      ret = fwrite(&headers[i], 1, sizeof(struct header), outfiles[i]);
-      if (ret != sizeof(struct header)) { 
-	  perror("header write failed"); 
-	  exit(1); 
-      }
-      ret = fclose(outfiles[i]);
-      if (ret != 0) { perror("error closing file??"); exit(1); }
+  for (i = 0; i < rows; i++) {
+    if (close(out_fds[i]) != 0) { perror("error closing file??"); exit(1); }
   }
-
+  close(in_fd);
   exit(0);
 }
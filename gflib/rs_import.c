@@ -0,0 +1,593 @@
+/*
+   (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+
+   Multi-threaded import engine.  Reads jobs from stdin, one per line
+   with tab separated fields, and runs them on a pool of threads:
+
+     I <tag> <n> <m> <source> <dest 0> ... <dest n+m-1>
+       encodes source straight into temporary files next to each
+       dest, verifies them, fsyncs them and renames them into place.
+     V <tag> <source> <chunk> ...
+       checks that the chunks are intact and that they hold source.
+     C <tag> <path> <source>
+       looks for a file with source's size and SHA1 at some other
+       path in the content tables (see chunk_index.h) of the eccdirs,
+       so that source can share its chunks instead of being encoded.
+
+   Each finished job prints "ok\t<tag>" or "error\t<tag>\t<why>" on
+   stdout, in completion order; a C job that finds a copy prints
+   "copy\t<tag>\t<path of the copy>" instead of ok.  Otherwise the
+   eccdirs on the command line are only used to pick the default
+   number of threads, one per filesystem up to the number of CPUs,
+   since the writes to the chunk files are what usually limits an
+   import.
+
+   Verification levels for imports: 0 none, 1 (default) re-read every
+   chunk and check all of its hashes, the crosschunk hash and the
+   file hash, 2 also rebuild the file with each run of m consecutive
+   chunks missing, as import.pl used to.
+
+   -v 4 writes version 4 chunks (see header.h) hashed with -H sha1,
+   sha256 (the default) or blake2s; with -s 0 they are not striped.
+*/
+
+#define _XOPEN_SOURCE 600
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "chunk_hash.h"
+#include "chunk_index.h"
+#include "gflib.h"
+#include "header.h"
+#include "rs_stream.h"
+
+#define MAX_FIELDS (RS_MAX_CHUNKS + 4)
+
+/* chunks up to this size are encoded in a single window, which lets
+   rs_encode_stream read the source only once */
+#define SINGLE_PASS_MAX (8*1024*1024)
+
+struct job {
+  struct job *next;
+  char *line;
+  int nfields;
+  char *fields[MAX_FIELDS];
+};
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct job *queue_head = NULL, **queue_tail = &queue_head;
+static int queue_done = 0;
+static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The content tables of the eccdirs, read by the first C job */
+struct content_table {
+  char *buf;
+  const struct chunk_content_entry *entries;
+  uint64_t nentries;
+  const char *paths;
+};
+
+static char **eccdirs;
+static int neccdirs;
+static struct content_table *tables;
+static int ntables;
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static struct rs_encode_params default_params;
+static int verify_level = 1;
+static int verbose = 0;
+
+void
+usage()
+{
+  fprintf(stderr, "usage: rs_import [-t threads] [-v version] [-s stripe-shift] [-H hash] [-w window-KiB] [-V verify-level] [-d] [eccdir...]\n");
+  exit(1);
+}
+
+static void report(const char *tag, const char *fmt, ...)
+{
+  va_list ap;
+
+  pthread_mutex_lock(&output_mutex);
+  if (fmt == NULL) {
+    printf("ok\t%s\n", tag);
+  } else {
+    printf("error\t%s\t", tag);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    va_start(ap, fmt);
+    fprintf(stderr, "rs_import: %s: ", tag);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+  }
+  fflush(stdout);
+  pthread_mutex_unlock(&output_mutex);
+}
+
+static void report_copy(const char *tag, const char *path)
+{
+  pthread_mutex_lock(&output_mutex);
+  printf("copy\t%s\t%s\n", tag, path);
+  fflush(stdout);
+  pthread_mutex_unlock(&output_mutex);
+}
+
+static void dirname_of(const char *path, char *dir)
+{
+  const char *slash = strrchr(path, '/');
+
+  if (slash == NULL) {
+    strcpy(dir, ".");
+  } else if (slash == path) {
+    strcpy(dir, "/");
+  } else {
+    memcpy(dir, path, slash - path);
+    dir[slash - path] = '\0';
+  }
+}
+
+/* <dir of path>/.eccfs-import.<base>.<pid>; the reserved prefix keeps
+   it out of eccfs listings if we die before the rename */
+static void temp_name(const char *path, char *tmp)
+{
+  const char *slash = strrchr(path, '/');
+  int dirlen = slash == NULL ? 0 : slash - path + 1;
+
+  snprintf(tmp, PATH_MAX, "%.*s.eccfs-import.%s.%d", dirlen, path,
+           path + dirlen, (int) getpid());
+}
+
+static int fsync_dir(const char *path)
+{
+  char dir[PATH_MAX];
+  int fd, ret;
+
+  dirname_of(path, dir);
+  fd = open(dir, O_RDONLY);
+  if (fd == -1) return -1;
+  ret = fsync(fd);
+  close(fd);
+  return ret;
+}
+
+/* Builds a chunk set from fresh fds on the files; drop_start..+ndrop-1
+   are left out */
+static rs_chunk_set *open_set(char **names, int count, int drop_start, int ndrop)
+{
+  rs_chunk_set *set = rs_chunk_set_new(verbose);
+  int i, fd;
+
+  for (i = 0; i < count; i++) {
+    if (i >= drop_start && i < drop_start + ndrop) continue;
+    fd = open(names[i], O_RDONLY);
+    if (fd == -1) {
+      fprintf(stderr, "%s: %s\n", names[i], strerror(errno));
+      rs_chunk_set_free(set);
+      return NULL;
+    }
+    if (rs_chunk_set_add(set, fd, names[i]) < 0) {
+      close(fd);
+      rs_chunk_set_free(set);
+      return NULL;
+    }
+  }
+  return set;
+}
+
+static int verify_chunks(char **names, int n, int m, int level)
+{
+  rs_chunk_set *set;
+  int start, ret;
+
+  if (level >= 1) {
+    set = open_set(names, n + m, 0, 0);
+    if (set == NULL) return -1;
+    ret = rs_chunk_set_check(set, default_params.window);
+    rs_chunk_set_free(set);
+    if (ret != 0) return -1;
+  }
+  if (level >= 2) {
+    for (start = 0; start < n; start++) {
+      set = open_set(names, n + m, start, m);
+      if (set == NULL) return -1;
+      ret = rs_decode_range(set, 0, rs_chunk_set_size(set), -1,
+                            default_params.window);
+      rs_chunk_set_free(set);
+      if (ret != 0) {
+        fprintf(stderr, "unable to recover without chunks %d..%d\n",
+                start, start + m - 1);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void import_job(struct job *j)
+{
+  const char *tag = j->fields[1], *source;
+  char *tmps[RS_MAX_CHUNKS], **dests;
+  int out_fds[RS_MAX_CHUNKS], created = 0, in_fd = -1, i, rows;
+  struct rs_encode_params params = default_params;
+  struct stat st;
+
+  if (j->nfields < 5) {
+    report(tag, "malformed import job");
+    return;
+  }
+  params.n = atoi(j->fields[2]);
+  params.m = atoi(j->fields[3]);
+  source = j->fields[4];
+  dests = j->fields + 5;
+  rows = params.n + params.m;
+  if (params.n < 1 || params.m < 0 || rows > RS_MAX_CHUNKS ||
+      j->nfields != 5 + rows) {
+    report(tag, "bad n/m or wrong number of destinations");
+    return;
+  }
+
+  in_fd = open(source, O_RDONLY);
+  if (in_fd == -1 || fstat(in_fd, &st) != 0) {
+    report(tag, "%s: %s", source, strerror(errno));
+    if (in_fd != -1) close(in_fd);
+    return;
+  }
+  if (params.window == 0 && (st.st_size + params.n - 1) / params.n <= SINGLE_PASS_MAX) {
+    params.window = (st.st_size + params.n - 1) / params.n;
+  }
+  for (created = 0; created < rows; created++) {
+    tmps[created] = (char *) malloc(PATH_MAX);
+    if (tmps[created] == NULL) { perror("malloc"); exit(1); }
+    temp_name(dests[created], tmps[created]);
+    out_fds[created] = open(tmps[created], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out_fds[created] == -1) {
+      report(tag, "%s: %s", tmps[created], strerror(errno));
+      free(tmps[created]);
+      goto out;
+    }
+  }
+
+  if (rs_encode_stream(in_fd, st.st_size, &params, out_fds, NULL) != 0) {
+    report(tag, "encode failed");
+    goto out;
+  }
+  if (verify_chunks(tmps, params.n, params.m, verify_level) != 0) {
+    report(tag, "verify failed");
+    goto out;
+  }
+  for (i = 0; i < rows; i++) {
+    if (fsync(out_fds[i]) != 0) {
+      report(tag, "fsync %s: %s", tmps[i], strerror(errno));
+      goto out;
+    }
+  }
+  for (i = 0; i < rows; i++) {
+    if (rename(tmps[i], dests[i]) != 0) {
+      /* the earlier ones are in place and complete; the caller treats
+         the file as not imported and tidies up */
+      report(tag, "rename to %s: %s", dests[i], strerror(errno));
+      goto out;
+    }
+    tmps[i][0] = '\0';
+  }
+  for (i = 0; i < rows; i++) {
+    if (fsync_dir(dests[i]) != 0) {
+      report(tag, "fsync directory of %s: %s", dests[i], strerror(errno));
+      goto out;
+    }
+  }
+  report(tag, NULL);
+
+ out:
+  for (i = 0; i < created; i++) {
+    close(out_fds[i]);
+    if (tmps[i][0] != '\0') unlink(tmps[i]);
+    free(tmps[i]);
+  }
+  close(in_fd);
+}
+
+static int hash_file(const char *path, unsigned hash_type, unsigned char *digest)
+{
+  const size_t bufsize = RS_STREAM_WINDOW_DEFAULT;
+  unsigned char *buf;
+  chunk_hash_ctx *ctx;
+  ssize_t amt;
+  int fd = open(path, O_RDONLY);
+
+  if (fd == -1) return -1;
+  buf = (unsigned char *) malloc(bufsize);
+  if (buf == NULL) { perror("malloc"); exit(1); }
+  ctx = chunk_hash_new(hash_type);
+  while ((amt = read(fd, buf, bufsize)) > 0) {
+    chunk_hash_update(ctx, buf, amt);
+  }
+  chunk_hash_final(ctx, digest);
+  chunk_hash_free(ctx);
+  free(buf);
+  close(fd);
+  return amt == 0 ? 0 : -1;
+}
+
+static void verify_job(struct job *j)
+{
+  const char *tag = j->fields[1];
+  unsigned char digest[20];
+  const struct header *h;
+  rs_chunk_set *set;
+  int ret;
+
+  if (j->nfields < 4) {
+    report(tag, "malformed verify job");
+    return;
+  }
+  set = open_set(j->fields + 3, j->nfields - 3, 0, 0);
+  if (set == NULL) {
+    report(tag, "unusable chunk");
+    return;
+  }
+  ret = rs_chunk_set_check(set, default_params.window);
+  h = rs_chunk_set_header(set);
+  if (ret == 0 && hash_file(j->fields[2], rs_chunk_set_hash_type(set), digest) != 0) {
+    report(tag, "%s: %s", j->fields[2], strerror(errno));
+  } else if (ret != 0) {
+    report(tag, "chunks did not verify");
+  } else if (memcmp(digest, h->sha1_file_hash, 20) != 0) {
+    report(tag, "%s does not match its chunks", j->fields[2]);
+  } else {
+    report(tag, NULL);
+  }
+  rs_chunk_set_free(set);
+}
+
+/* An eccdir without a content table just has nothing to share */
+static void load_tables(void)
+{
+  char name[PATH_MAX];
+  struct content_table *t;
+  struct stat st;
+  int i, fd;
+
+  tables = (struct content_table *) calloc(neccdirs + 1, sizeof(*tables));
+  if (tables == NULL) { perror("malloc"); exit(1); }
+  for (i = 0; i < neccdirs; i++) {
+    snprintf(name, sizeof(name), "%s/%s", eccdirs[i], CHUNK_CONTENT_NAME);
+    fd = open(name, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) != 0) {
+      if (fd != -1) close(fd);
+      continue;
+    }
+    t = &tables[ntables];
+    t->buf = (char *) malloc(st.st_size + 1);
+    if (t->buf == NULL) { perror("malloc"); exit(1); }
+    if (rs_pread_full(fd, t->buf, st.st_size, 0) != 0 ||
+        (t->entries = chunk_content_entries(t->buf, st.st_size, &t->nentries,
+                                            &t->paths)) == NULL) {
+      fprintf(stderr, "rs_import: %s is unusable; rerun rs_index\n", name);
+      free(t->buf);
+    } else {
+      ntables++;
+    }
+    close(fd);
+  }
+}
+
+static void copy_job(struct job *j)
+{
+  const char *tag = j->fields[1], *path, *source;
+  const struct chunk_content_entry *e, *end;
+  unsigned char digest[20];
+  struct stat st;
+  int i, sized = 0;
+
+  if (j->nfields != 4) {
+    report(tag, "malformed copy job");
+    return;
+  }
+  path = j->fields[2];
+  source = j->fields[3];
+  pthread_once(&tables_once, load_tables);
+  if (stat(source, &st) != 0) {
+    report(tag, "%s: %s", source, strerror(errno));
+    return;
+  }
+  /* only files of a size some eccdir has are worth hashing */
+  for (i = 0; i < ntables && !sized; i++) {
+    sized = chunk_content_find(tables[i].entries, tables[i].nentries,
+                               st.st_size, NULL) != NULL;
+  }
+  if (!sized) {
+    report(tag, NULL);
+    return;
+  }
+  if (hash_file(source, CHUNK_HASH_SHA1, digest) != 0) {
+    report(tag, "%s: %s", source, strerror(errno));
+    return;
+  }
+  for (i = 0; i < ntables; i++) {
+    e = chunk_content_find(tables[i].entries, tables[i].nentries, st.st_size, digest);
+    end = tables[i].entries + tables[i].nentries;
+    for (; e != NULL && e < end && e->orig_size == (uint64_t) st.st_size &&
+           memcmp(e->file_hash, digest, 20) == 0; e++) {
+      if (strcmp(tables[i].paths + e->path_offset, path) != 0) {
+        report_copy(tag, tables[i].paths + e->path_offset);
+        return;
+      }
+    }
+  }
+  report(tag, NULL);
+}
+
+static void *worker(void *arg)
+{
+  struct job *j;
+
+  for (;;) {
+    pthread_mutex_lock(&queue_mutex);
+    while (queue_head == NULL && !queue_done) {
+      pthread_cond_wait(&queue_cond, &queue_mutex);
+    }
+    j = queue_head;
+    if (j != NULL) {
+      queue_head = j->next;
+      if (queue_head == NULL) queue_tail = &queue_head;
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    if (j == NULL) return NULL;
+
+    if (strcmp(j->fields[0], "I") == 0) {
+      import_job(j);
+    } else if (strcmp(j->fields[0], "C") == 0) {
+      copy_job(j);
+    } else {
+      verify_job(j);
+    }
+    free(j->line);
+    free(j);
+  }
+}
+
+/* Splits line in place; NULL (after reporting) if it is unusable */
+static struct job *parse_job(char *line)
+{
+  struct job *j = (struct job *) calloc(1, sizeof(struct job));
+  char *p = line;
+
+  if (j == NULL) { perror("malloc"); exit(1); }
+  j->line = line;
+  while (j->nfields < MAX_FIELDS) {
+    j->fields[j->nfields++] = p;
+    p = strchr(p, '\t');
+    if (p == NULL) break;
+    *p++ = '\0';
+  }
+  if (p != NULL || j->nfields < 2 ||
+      (strcmp(j->fields[0], "I") != 0 && strcmp(j->fields[0], "V") != 0 &&
+       strcmp(j->fields[0], "C") != 0)) {
+    report(j->nfields >= 2 ? j->fields[1] : "-", "unparseable job");
+    free(line);
+    free(j);
+    return NULL;
+  }
+  return j;
+}
+
+/* one thread per filesystem, up to the number of cpus */
+static int default_threads(int ndirs, char **dirs)
+{
+  dev_t devs[RS_MAX_CHUNKS];
+  struct stat st;
+  int i, k, ndevs = 0;
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (i = 0; i < ndirs; i++) {
+    if (stat(dirs[i], &st) != 0) {
+      perror(dirs[i]);
+      exit(1);
+    }
+    for (k = 0; k < ndevs && devs[k] != st.st_dev; k++) ;
+    if (k == ndevs && ndevs < RS_MAX_CHUNKS) devs[ndevs++] = st.st_dev;
+  }
+  if (ndevs == 0) ndevs = 1;
+  if (ncpus > 0 && ndevs > ncpus) ndevs = ncpus;
+  return ndevs;
+}
+
+int
+main(int argc, char **argv)
+{
+  int nthreads = 0, opt, i;
+  pthread_t *threads;
+  char buf[16384];
+  char *line = NULL;
+  size_t linelen = 0;
+  struct job *j;
+
+  memset(&default_params, 0, sizeof(default_params));
+  default_params.version = 2;
+  default_params.hash_block_shift = HEADER_HASH_BLOCK_SHIFT_DEFAULT;
+  default_params.stripe_shift = HEADER_STRIPE_SHIFT_DEFAULT;
+  default_params.hash_type = CHUNK_HASH_SHA256;
+  while ((opt = getopt(argc, argv, "t:v:s:H:w:V:d")) != -1) {
+    switch (opt) {
+    case 't': nthreads = atoi(optarg); break;
+    case 'v': default_params.version = atoi(optarg); break;
+    case 's': default_params.stripe_shift = atoi(optarg); break;
+    case 'H': default_params.hash_type = chunk_hash_lookup(optarg); break;
+    case 'w': default_params.window = (size_t) atoi(optarg) * 1024; break;
+    case 'V': verify_level = atoi(optarg); break;
+    case 'd': verbose = 1; break;
+    default: usage();
+    }
+  }
+  if (default_params.version < 1 || default_params.version > 4 ||
+      default_params.hash_type < 0 ||
+      nthreads < 0 || verify_level < 0 || verify_level > 2) {
+    usage();
+  }
+  eccdirs = argv + optind;
+  neccdirs = argc - optind;
+  if (nthreads == 0) nthreads = default_threads(neccdirs, eccdirs);
+
+  /* the gflib tables are built unlocked */
+  gf_modar_setup();
+  gf_region_setup();
+
+  threads = (pthread_t *) malloc(sizeof(pthread_t) * nthreads);
+  if (threads == NULL) { perror("malloc"); exit(1); }
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+
+  /* lines can be longer than buf, n+m paths */
+  while (fgets(buf, sizeof(buf), stdin) != NULL) {
+    size_t len = strlen(buf);
+    line = (char *) realloc(line, linelen + len + 1);
+    if (line == NULL) { perror("realloc"); exit(1); }
+    memcpy(line + linelen, buf, len + 1);
+    linelen += len;
+    if (line[linelen - 1] != '\n' && !feof(stdin)) continue;
+    if (line[linelen - 1] == '\n') line[--linelen] = '\0';
+    j = linelen == 0 ? NULL : parse_job(line);
+    if (j == NULL && linelen == 0) free(line);
+    line = NULL;
+    linelen = 0;
+    if (j == NULL) continue;
+
+    pthread_mutex_lock(&queue_mutex);
+    *queue_tail = j;
+    queue_tail = &j->next;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+  }
+  free(line);
+
+  pthread_mutex_lock(&queue_mutex);
+  queue_done = 1;
+  pthread_cond_broadcast(&queue_cond);
+  pthread_mutex_unlock(&queue_mutex);
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  exit(0);
+}
@@ -0,0 +1,454 @@
+/*
+   (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+
+   Builds the chunk index (see chunk_index.h) of each eccdir given,
+   and the content table next to it.  By default every eccdir is
+   scanned in full.  With -u, paths
+   relative to the eccdirs are read from stdin, one per line, and only
+   their entries are redone; this is what the importer uses after
+   adding files.  An eccdir without a usable index and content table
+   is scanned in full either way.
+
+   usage: rs_index [-u] [-v] eccdir...
+*/
+
+#define _XOPEN_SOURCE 600
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "header.h"
+#include "chunk_index.h"
+#include "rs_stream.h"
+
+struct entry_list {
+  struct chunk_index_entry *e;
+  uint64_t n, alloc;
+};
+
+/* the content table as it is built; paths are malloced */
+struct content_item {
+  uint64_t orig_size;
+  unsigned char file_hash[20];
+  char *path;
+};
+
+struct content_list {
+  struct content_item *e;
+  uint64_t n, alloc;
+};
+
+static int verbose = 0;
+
+void
+usage()
+{
+  fprintf(stderr, "usage: rs_index [-u] [-v] eccdir...\n");
+  exit(1);
+}
+
+static struct chunk_index_entry *add_entry(struct entry_list *l)
+{
+  if (l->n == l->alloc) {
+    l->alloc = l->alloc == 0 ? 1024 : 2 * l->alloc;
+    l->e = (struct chunk_index_entry *) realloc(l->e, l->alloc * sizeof(*l->e));
+    if (l->e == NULL) { perror("realloc"); exit(1); }
+  }
+  memset(&l->e[l->n], 0, sizeof(*l->e));
+  return &l->e[l->n++];
+}
+
+static void add_content(struct content_list *l, const struct chunk_index_entry *e,
+                        const char *path)
+{
+  struct content_item *c;
+
+  if (l->n == l->alloc) {
+    l->alloc = l->alloc == 0 ? 1024 : 2 * l->alloc;
+    l->e = (struct content_item *) realloc(l->e, l->alloc * sizeof(*l->e));
+    if (l->e == NULL) { perror("realloc"); exit(1); }
+  }
+  c = &l->e[l->n++];
+  c->orig_size = e->orig_size;
+  memcpy(c->file_hash, e->file_hash, 20);
+  c->path = strdup(path);
+  if (c->path == NULL) { perror("malloc"); exit(1); }
+}
+
+static void free_content(struct content_list *l)
+{
+  uint64_t i;
+
+  for (i = 0; i < l->n; i++) free(l->e[i].path);
+  free(l->e);
+}
+
+static int reserved_path(const char *path)
+{
+  return strncmp(path, ".eccfs-", 7) == 0 || strstr(path, "/.eccfs-") != NULL;
+}
+
+/* Fills in e for eccdir + path; 1 if it belongs in the index, 0 if
+   not (missing, or unusable after saying why).  A file with a SHA1
+   file hash also goes in content. */
+static int make_entry(const char *eccdir, const char *path,
+                      struct chunk_index_entry *e, struct content_list *content)
+{
+  char full[PATH_MAX];
+  struct stat st;
+  struct header h;
+  struct header_v2 ext;
+  struct chunk_layout layout;
+  int fd, ok;
+
+  if (reserved_path(path)) return 0;
+  snprintf(full, sizeof(full), "%s%s", eccdir, strcmp(path, "/") == 0 ? "" : path);
+  if (lstat(full, &st) != 0) {
+    if (errno != ENOENT) fprintf(stderr, "%s: %s\n", full, strerror(errno));
+    return 0;
+  }
+  memset(e, 0, sizeof(*e));
+  chunk_index_path_hash(path, e->path_hash);
+  if (S_ISDIR(st.st_mode)) {
+    e->type = CHUNK_INDEX_DIR;
+    return 1;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    fprintf(stderr, "%s: not a file or directory, skipped\n", full);
+    return 0;
+  }
+  fd = open(full, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "%s: %s\n", full, strerror(errno));
+    return 0;
+  }
+  memset(&ext, 0, sizeof(ext));
+  ok = rs_pread_full(fd, &h, sizeof(h), 0) == 0 &&
+    (h.version == 1 || rs_pread_full(fd, &ext, sizeof(ext), sizeof(h)) == 0) &&
+    chunk_layout_from_size(&h, &ext, st.st_size, &layout) &&
+    getn(&h) > 0 && layout.blocksize * getn(&h) >= h.under_size;
+  close(fd);
+  if (!ok) {
+    fprintf(stderr, "%s: not a usable chunk, skipped\n", full);
+    return 0;
+  }
+  e->type = CHUNK_INDEX_FILE;
+  e->orig_size = layout.blocksize * getn(&h) - h.under_size;
+  memcpy(e->file_hash, h.sha1_file_hash, 20);
+  e->n = getn(&h);
+  e->m = getm(&h);
+  e->chunknum = getchunknum(&h);
+  if (h.version <= 3) add_content(content, e, path);
+  return 1;
+}
+
+/* nftw has no way to pass these through */
+static const char *scan_eccdir;
+static struct entry_list *scan_list;
+static struct content_list *scan_content;
+
+static int scan_one(const char *full, const struct stat *st, int flag, struct FTW *ftw)
+{
+  const char *path = full + strlen(scan_eccdir);
+  struct chunk_index_entry e;
+
+  if (*path == '\0') path = "/";
+  if (make_entry(scan_eccdir, path, &e, scan_content)) {
+    *add_entry(scan_list) = e;
+  }
+  return 0;
+}
+
+static int scan(const char *eccdir, struct entry_list *l, struct content_list *c)
+{
+  scan_eccdir = eccdir;
+  scan_list = l;
+  scan_content = c;
+  if (nftw(eccdir, scan_one, 32, FTW_PHYS) != 0) {
+    fprintf(stderr, "unable to scan %s: %s\n", eccdir, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/* Reads an existing index; 0 if there isn't a usable one */
+static int load(const char *eccdir, struct entry_list *l, uint64_t *built_at)
+{
+  char name[PATH_MAX];
+  struct stat st;
+  const struct chunk_index_entry *entries;
+  uint64_t nentries, i;
+  char *buf;
+  int fd;
+
+  snprintf(name, sizeof(name), "%s/%s", eccdir, CHUNK_INDEX_NAME);
+  fd = open(name, O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) != 0) {
+    if (fd != -1) close(fd);
+    return 0;
+  }
+  buf = (char *) malloc(st.st_size + 1);
+  if (buf == NULL) { perror("malloc"); exit(1); }
+  if (rs_pread_full(fd, buf, st.st_size, 0) != 0 ||
+      (entries = chunk_index_entries(buf, st.st_size, &nentries)) == NULL) {
+    fprintf(stderr, "%s: unusable, rebuilding\n", name);
+    free(buf);
+    close(fd);
+    return 0;
+  }
+  for (i = 0; i < nentries; i++) {
+    *add_entry(l) = entries[i];
+  }
+  *built_at = ((const struct chunk_index_header *) buf)->built_at;
+  free(buf);
+  close(fd);
+  return 1;
+}
+
+/* Reads an existing content table; 0 if there isn't a usable one */
+static int load_content(const char *eccdir, struct content_list *l)
+{
+  char name[PATH_MAX];
+  struct stat st;
+  const struct chunk_content_entry *entries;
+  struct chunk_index_entry e;
+  const char *paths;
+  uint64_t nentries, i;
+  char *buf;
+  int fd;
+
+  snprintf(name, sizeof(name), "%s/%s", eccdir, CHUNK_CONTENT_NAME);
+  fd = open(name, O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) != 0) {
+    if (fd != -1) close(fd);
+    return 0;
+  }
+  buf = (char *) malloc(st.st_size + 1);
+  if (buf == NULL) { perror("malloc"); exit(1); }
+  if (rs_pread_full(fd, buf, st.st_size, 0) != 0 ||
+      (entries = chunk_content_entries(buf, st.st_size, &nentries, &paths)) == NULL) {
+    fprintf(stderr, "%s: unusable, rebuilding\n", name);
+    free(buf);
+    close(fd);
+    return 0;
+  }
+  for (i = 0; i < nentries; i++) {
+    e.orig_size = entries[i].orig_size;
+    memcpy(e.file_hash, entries[i].file_hash, 20);
+    add_content(l, &e, paths + entries[i].path_offset);
+  }
+  free(buf);
+  close(fd);
+  return 1;
+}
+
+static int compare_content(const void *a, const void *b)
+{
+  const struct content_item *x = (const struct content_item *) a;
+  const struct content_item *y = (const struct content_item *) b;
+
+  if (x->orig_size != y->orig_size) return x->orig_size < y->orig_size ? -1 : 1;
+  if (memcmp(x->file_hash, y->file_hash, 20) != 0) {
+    return memcmp(x->file_hash, y->file_hash, 20);
+  }
+  return strcmp(x->path, y->path);
+}
+
+static int write_content(const char *eccdir, struct content_list *l)
+{
+  char name[PATH_MAX], tmp[PATH_MAX + 8];
+  struct chunk_content_header h;
+  struct chunk_content_entry *entries;
+  uint64_t i, paths_size = 0, offset;
+  int fd, ok, ret = 0;
+
+  qsort(l->e, l->n, sizeof(*l->e), compare_content);
+  entries = (struct chunk_content_entry *) calloc(l->n + 1, sizeof(*entries));
+  if (entries == NULL) { perror("malloc"); exit(1); }
+  for (i = 0; i < l->n; i++) {
+    entries[i].orig_size = l->e[i].orig_size;
+    memcpy(entries[i].file_hash, l->e[i].file_hash, 20);
+    entries[i].path_offset = paths_size;
+    paths_size += strlen(l->e[i].path) + 1;
+  }
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CHUNK_CONTENT_MAGIC, 8);
+  h.entry_size = sizeof(struct chunk_content_entry);
+  h.nentries = l->n;
+  h.paths_size = paths_size;
+
+  snprintf(name, sizeof(name), "%s/%s", eccdir, CHUNK_CONTENT_NAME);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ok = fd != -1 &&
+    rs_pwrite_full(fd, &h, sizeof(h), 0) == 0 &&
+    rs_pwrite_full(fd, entries, l->n * sizeof(*entries), sizeof(h)) == 0;
+  offset = sizeof(h) + l->n * sizeof(*entries);
+  for (i = 0; i < l->n && ok; i++) {
+    size_t len = strlen(l->e[i].path) + 1;
+    ok = rs_pwrite_full(fd, l->e[i].path, len, offset) == 0;
+    offset += len;
+  }
+  ok = ok && fsync(fd) == 0;
+  if (fd != -1 && close(fd) != 0) ok = 0;
+  if (!ok || rename(tmp, name) != 0) {
+    fprintf(stderr, "unable to write %s: %s\n", name, strerror(errno));
+    unlink(tmp);
+    ret = -1;
+  }
+  free(entries);
+  /* the directory is synced along with the index */
+  return ret;
+}
+
+static int write_index(const char *eccdir, struct entry_list *l, uint64_t built_at)
+{
+  char name[PATH_MAX], tmp[PATH_MAX + 8];
+  struct chunk_index_header h;
+  uint64_t i, out;
+  int fd, dir_fd;
+
+  qsort(l->e, l->n, sizeof(*l->e), chunk_index_compare);
+  /* a path hash only appears once; keep the last one */
+  for (i = 0, out = 0; i < l->n; i++) {
+    if (out > 0 && chunk_index_compare(&l->e[out - 1], &l->e[i]) == 0) out--;
+    l->e[out++] = l->e[i];
+  }
+  l->n = out;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CHUNK_INDEX_MAGIC, 8);
+  h.entry_size = sizeof(struct chunk_index_entry);
+  h.nentries = l->n;
+  h.built_at = built_at;
+
+  snprintf(name, sizeof(name), "%s/%s", eccdir, CHUNK_INDEX_NAME);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1 ||
+      rs_pwrite_full(fd, &h, sizeof(h), 0) != 0 ||
+      rs_pwrite_full(fd, l->e, l->n * sizeof(*l->e), sizeof(h)) != 0 ||
+      fsync(fd) != 0 || close(fd) != 0 || rename(tmp, name) != 0) {
+    fprintf(stderr, "unable to write %s: %s\n", name, strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+  dir_fd = open(eccdir, O_RDONLY);
+  if (dir_fd != -1) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  if (verbose) {
+    fprintf(stderr, "%s: %lld entries\n", name, (long long) l->n);
+  }
+  return 0;
+}
+
+/* Redoes the entries for paths; hashes holds their hashes, sorted */
+static void update(const char *eccdir, struct entry_list *l, struct content_list *c,
+                   char **paths, uint64_t npaths, const struct entry_list *hashes)
+{
+  struct chunk_index_entry e;
+  uint64_t i, out;
+
+  for (i = 0, out = 0; i < l->n; i++) {
+    if (bsearch(&l->e[i], hashes->e, hashes->n, sizeof(e), chunk_index_compare) == NULL) {
+      l->e[out++] = l->e[i];
+    }
+  }
+  l->n = out;
+  for (i = 0, out = 0; i < c->n; i++) {
+    chunk_index_path_hash(c->e[i].path, e.path_hash);
+    if (bsearch(&e, hashes->e, hashes->n, sizeof(e), chunk_index_compare) == NULL) {
+      c->e[out++] = c->e[i];
+    } else {
+      free(c->e[i].path);
+    }
+  }
+  c->n = out;
+  for (i = 0; i < npaths; i++) {
+    if (make_entry(eccdir, paths[i], &e, c)) {
+      *add_entry(l) = e;
+    }
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  struct entry_list hashes = { NULL, 0, 0 };
+  char **paths = NULL, buf[PATH_MAX + 2];
+  int opt, updating = 0, i, ret = 0;
+  uint64_t npaths = 0, built_at;
+  size_t len;
+
+  while ((opt = getopt(argc, argv, "uv")) != -1) {
+    switch (opt) {
+    case 'u': updating = 1; break;
+    case 'v': verbose = 1; break;
+    default: usage();
+    }
+  }
+  if (optind == argc) usage();
+
+  if (updating) {
+    while (fgets(buf + 1, sizeof(buf) - 1, stdin) != NULL) {
+      char *path = buf + 1;
+      len = strlen(path);
+      if (len > 0 && path[len - 1] == '\n') path[--len] = '\0';
+      if (*path != '/') *--path = '/';
+      paths = (char **) realloc(paths, (npaths + 1) * sizeof(char *));
+      if (paths == NULL || (paths[npaths] = strdup(path)) == NULL) {
+        perror("malloc");
+        exit(1);
+      }
+      chunk_index_path_hash(paths[npaths], add_entry(&hashes)->path_hash);
+      npaths++;
+    }
+    qsort(hashes.e, hashes.n, sizeof(*hashes.e), chunk_index_compare);
+  }
+
+  for (i = optind; i < argc; i++) {
+    struct entry_list l = { NULL, 0, 0 };
+    struct content_list c = { NULL, 0, 0 };
+
+    /* paths are everything after the eccdir, starting with '/' */
+    len = strlen(argv[i]);
+    while (len > 1 && argv[i][len - 1] == '/') argv[i][--len] = '\0';
+
+    if (updating && load(argv[i], &l, &built_at) && load_content(argv[i], &c)) {
+      update(argv[i], &l, &c, paths, npaths, &hashes);
+    } else {
+      free_content(&c);
+      c.e = NULL;
+      c.n = c.alloc = 0;
+      l.n = 0;
+      built_at = time(NULL);
+      if (scan(argv[i], &l, &c) != 0) {
+        ret = 1;
+        free(l.e);
+        free_content(&c);
+        continue;
+      }
+    }
+    /* the content table first, so that a new index means a new table */
+    if (write_content(argv[i], &c) != 0 || write_index(argv[i], &l, built_at) != 0) {
+      ret = 1;
+    }
+    free(l.e);
+    free_content(&c);
+  }
+  exit(ret);
+}
@@ -0,0 +1,822 @@
+/*
+   (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+
+   Each pass reads the same window of all n data chunks (n preads
+   marching through the file in parallel), computes the parity for
+   that window and writes the window of all n+m chunk files.  The
+   per-chunk digest (SHA1(data) for version 1, SHA1(header_v2, table)
+   for version 2) is kept running since the windows arrive in order;
+   the version 2 table is written a window's worth at a time.  The
+   headers are written last.
+
+   The file hash has to see the file in order, which the window
+   order does not do for the contiguous layout; chunk 0 is hashed as
+   it goes by and the rest of the file is re-read sequentially at the
+   end.  When a whole chunk fits in one window there is only the one
+   pass and the file is read just once.  The striped layout (version
+   3, and version 4 with a stripe shift) has windows that are whole
+   rows of stripe units, so a window of all the data chunks is a
+   contiguous piece of the file and the file is only ever read once.
+
+   The block hashes of a window of all n+m chunks are computed
+   together with chunk_hash_blocks, which spreads them over the CPUs;
+   likewise the decoder verifies the windows of all the chunks it
+   decodes from at once.  "SHA1" here means the chunk's hash, which
+   is only something else for version 4.
+*/
+
+#define _XOPEN_SOURCE 600
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "chunk_hash.h"
+#include "rs_codec.h"
+#include "rs_stream.h"
+
+int rs_pread_full(int fd, void *buf, size_t len, uint64_t offset)
+{
+  ssize_t amt;
+
+  while (len > 0) {
+    amt = pread(fd, buf, len, offset);
+    if (amt < 0 && errno == EINTR) continue;
+    if (amt <= 0) {
+      if (amt == 0) errno = EIO;
+      return -1;
+    }
+    buf = (char *) buf + amt;
+    len -= amt;
+    offset += amt;
+  }
+  return 0;
+}
+
+int rs_pwrite_full(int fd, const void *buf, size_t len, uint64_t offset)
+{
+  ssize_t amt;
+
+  while (len > 0) {
+    amt = pwrite(fd, buf, len, offset);
+    if (amt < 0 && errno == EINTR) continue;
+    if (amt < 0) return -1;
+    buf = (const char *) buf + amt;
+    len -= amt;
+    offset += amt;
+  }
+  return 0;
+}
+
+/* Striped: fills the windows [off, off+amt) of the n data chunks,
+   reading the file in order; off and amt are whole stripe units
+   except at the end of the chunks. */
+static int read_stripes(int in_fd, uint64_t size, const struct chunk_layout *l,
+                        int n, uint64_t off, size_t amt, uint8_t **bufs,
+                        chunk_hash_ctx *file_ctx)
+{
+  unsigned long long pos, end, run, co;
+  unsigned c;
+  int i;
+
+  for (i = 0; i < n; i++) memset(bufs[i], 0, amt);
+  pos = chunk_file_offset(l, n, 0, off, &run);
+  end = off + amt == l->blocksize ? (uint64_t) n * l->blocksize
+    : chunk_file_offset(l, n, 0, off + amt, &run);
+  if (end > size) end = size;
+  for (; pos < end; pos += run) {
+    run = chunk_locate(l, n, pos, &c, &co);
+    if (run > end - pos) run = end - pos;
+    if (rs_pread_full(in_fd, bufs[c] + (co - off), run, pos) != 0) return -1;
+    chunk_hash_update(file_ctx, bufs[c] + (co - off), run);
+  }
+  return 0;
+}
+
+int rs_encode_stream(int in_fd, uint64_t size, const struct rs_encode_params *p,
+                     const int *out_fds, struct header *headers_out)
+{
+  int n = p->n, m = p->m, rows = p->n + p->m, i, ret = -1, single_pass, striped;
+  uint64_t blocksize, off, data_offset, in_off, avail;
+  size_t window, amt, hash_block_size = 0, table_len = 0, nb;
+  struct header_v2 ext;
+  struct chunk_layout layout;
+  struct header *headers = NULL;
+  chunk_hash_ctx **digest = NULL, *file_ctx = NULL, *ctx = NULL;
+  struct chunk_hash_job *jobs = NULL;
+  unsigned char *space = NULL, *table = NULL;
+  uint8_t **bufs = NULL;
+
+  if (n < 1 || n > 31 || m < 0 || m > 31 || p->version < 1 || p->version > 4) {
+    fprintf(stderr, "rs_encode_stream: bad parameters n=%d m=%d version=%d\n",
+            n, m, p->version);
+    return -1;
+  }
+  memset(&ext, 0, sizeof(ext));
+  ext.hash_block_shift = p->hash_block_shift;
+  striped = p->version == 3 || (p->version == 4 && p->stripe_shift != 0);
+  ext.stripe_shift = striped ? p->stripe_shift : 0;
+  ext.hash_type = p->version == 4 ? p->hash_type : CHUNK_HASH_SHA1;
+  if (p->version != 1 && !header_v2_valid(p->version, &ext)) {
+    fprintf(stderr, "rs_encode_stream: bad hash block shift %d, stripe shift %d"
+            " or hash type %d\n", p->hash_block_shift, p->stripe_shift, p->hash_type);
+    return -1;
+  }
+
+  blocksize = (size + n - 1) / n;
+  data_offset = chunk_file_size(p->version, ext.hash_block_shift, blocksize) - blocksize;
+  window = p->window > 0 ? p->window : RS_STREAM_WINDOW_DEFAULT;
+  if (p->version != 1) {
+    /* windows have to hold whole hash blocks, and when striped
+       whole stripe units, which are whole hash blocks */
+    hash_block_size = (size_t) 1 << (striped ? ext.stripe_shift : ext.hash_block_shift);
+    window = (window + hash_block_size - 1) / hash_block_size * hash_block_size;
+    hash_block_size = (size_t) 1 << ext.hash_block_shift;
+    table_len = 20 * (window / hash_block_size + 1);
+  }
+  if (window > blocksize && blocksize > 0) window = blocksize;
+  single_pass = window >= blocksize || striped;
+  memset(&layout, 0, sizeof(layout));
+  layout.blocksize = blocksize;
+  layout.stripe_unit = striped ? 1ULL << ext.stripe_shift : 0;
+
+  headers = (struct header *) calloc(rows, sizeof(struct header));
+  digest = (chunk_hash_ctx **) calloc(rows, sizeof(chunk_hash_ctx *));
+  jobs = (struct chunk_hash_job *) malloc(sizeof(struct chunk_hash_job) * rows);
+  bufs = (uint8_t **) malloc(sizeof(uint8_t *) * rows);
+  space = (unsigned char *) malloc((size_t) rows * window + 1);
+  table = (unsigned char *) malloc((size_t) rows * table_len + 1);
+  if (headers == NULL || digest == NULL || jobs == NULL || bufs == NULL ||
+      space == NULL || table == NULL) {
+    perror("rs_encode_stream: malloc");
+    goto out;
+  }
+
+  for (i = 0; i < rows; i++) {
+    headers[i].version = p->version;
+    headers[i].under_size = blocksize * n - size;
+    setnmchunknum(headers + i, n, m, i);
+    bufs[i] = space + (size_t) i * window;
+    digest[i] = chunk_hash_new(ext.hash_type);
+    if (p->version != 1) {
+      chunk_hash_update(digest[i], &ext, sizeof(ext));
+      if (rs_pwrite_full(out_fds[i], &ext, sizeof(ext), sizeof(struct header)) != 0) {
+        perror("rs_encode_stream: write");
+        goto out;
+      }
+    }
+  }
+  file_ctx = chunk_hash_new(ext.hash_type);
+  ctx = chunk_hash_new(ext.hash_type);
+
+  for (off = 0; off < blocksize; off += amt) {
+    amt = blocksize - off > window ? window : blocksize - off;
+    if (striped) {
+      if (read_stripes(in_fd, size, &layout, n, off, amt, bufs, file_ctx) != 0) {
+        perror("rs_encode_stream: read");
+        goto out;
+      }
+    }
+    for (i = 0; i < n && !striped; i++) {
+      in_off = i * blocksize + off;
+      avail = in_off >= size ? 0 : size - in_off;
+      if (avail > amt) avail = amt;
+      if (avail > 0 && rs_pread_full(in_fd, bufs[i], avail, in_off) != 0) {
+        perror("rs_encode_stream: read");
+        goto out;
+      }
+      memset(bufs[i] + avail, 0, amt - avail);
+      if (i == 0 || single_pass) chunk_hash_update(file_ctx, bufs[i], avail);
+    }
+    rs_encode((const uint8_t **) bufs, bufs + n, amt, n, m);
+
+    if (p->version != 1) {
+      for (i = 0; i < rows; i++) {
+        jobs[i].data = bufs[i];
+        jobs[i].len = amt;
+        jobs[i].digests = table + (size_t) i * table_len;
+      }
+      chunk_hash_blocks(ext.hash_type, hash_block_size, jobs, rows, 0);
+    }
+    nb = hash_block_size > 0 ? (amt + hash_block_size - 1) / hash_block_size : 0;
+    for (i = 0; i < rows; i++) {
+      if (p->version == 1) {
+        chunk_hash_update(digest[i], bufs[i], amt);
+      } else {
+        chunk_hash_update(digest[i], jobs[i].digests, 20 * nb);
+        if (rs_pwrite_full(out_fds[i], jobs[i].digests, 20 * nb, sizeof(struct header)
+                           + sizeof(ext) + 20 * (off >> ext.hash_block_shift)) != 0) {
+          perror("rs_encode_stream: write");
+          goto out;
+        }
+      }
+      if (rs_pwrite_full(out_fds[i], bufs[i], amt, data_offset + off) != 0) {
+        perror("rs_encode_stream: write");
+        goto out;
+      }
+    }
+  }
+
+  /* the rest of the file hash; see the top of the file */
+  for (in_off = single_pass ? size : blocksize; in_off < size; in_off += amt) {
+    amt = size - in_off > (uint64_t) rows * window ? (uint64_t) rows * window : size - in_off;
+    if (rs_pread_full(in_fd, space, amt, in_off) != 0) {
+      perror("rs_encode_stream: read");
+      goto out;
+    }
+    chunk_hash_update(file_ctx, space, amt);
+  }
+  chunk_hash_final(file_ctx, headers[0].sha1_file_hash);
+
+  /* see header.h for how the hashes fit together */
+  for (i = 0; i < rows; i++) {
+    memcpy(headers[i].sha1_file_hash, headers[0].sha1_file_hash, 20);
+    chunk_hash_final(digest[i], headers[i].sha1_chunk_hash);
+  }
+  for (i = 0; i < rows; i++) {
+    chunk_hash_update(ctx, &headers[i], offsetof(struct header, sha1_crosschunk_hash));
+    chunk_hash_update(ctx, headers[i].sha1_chunk_hash, 20);
+  }
+  chunk_hash_final(ctx, headers[0].sha1_crosschunk_hash);
+  for (i = 0; i < rows; i++) {
+    memcpy(headers[i].sha1_crosschunk_hash, headers[0].sha1_crosschunk_hash, 20);
+    chunk_hash_update(ctx, &headers[i], sizeof(struct header));
+    chunk_hash_final(ctx, headers[i].sha1_chunk_hash);
+    if (rs_pwrite_full(out_fds[i], &headers[i], sizeof(struct header), 0) != 0) {
+      perror("rs_encode_stream: header write");
+      goto out;
+    }
+  }
+  if (headers_out != NULL) {
+    memcpy(headers_out, headers, sizeof(struct header) * rows);
+  }
+  ret = 0;
+
+ out:
+  for (i = 0; digest != NULL && i < rows; i++) {
+    chunk_hash_free(digest[i]);
+  }
+  chunk_hash_free(file_ctx);
+  chunk_hash_free(ctx);
+  free(headers);
+  free(digest);
+  free(jobs);
+  free(bufs);
+  free(space);
+  free(table);
+  return ret;
+}
+
+struct rs_chunk {
+  int fd;                 /* -1 if not present */
+  int bad;                /* failed verification, don't use */
+  char *name;
+  unsigned char *table;   /* version 2 block hashes */
+  chunk_hash_ctx *digest; /* version 1: SHA1(data) so far */
+  uint64_t hashed_upto;
+};
+
+struct rs_chunk_set {
+  int verbose;
+  int nchunks;            /* 0 until the first chunk is added */
+  struct header hdr;
+  struct header_v2 ext;
+  struct chunk_layout layout;
+  int n, m;
+  uint64_t orig_size;
+  struct rs_chunk chunks[RS_MAX_CHUNKS];
+  /* the decoder for the current set of usable chunks */
+  rs_decoder *decoder;
+  int decoder_present[RS_MAX_CHUNKS];
+};
+
+rs_chunk_set *rs_chunk_set_new(int verbose)
+{
+  rs_chunk_set *set = (rs_chunk_set *) calloc(1, sizeof(rs_chunk_set));
+  int i;
+
+  if (set == NULL) { perror("rs_chunk_set_new"); exit(1); }
+  set->verbose = verbose;
+  for (i = 0; i < RS_MAX_CHUNKS; i++) set->chunks[i].fd = -1;
+  return set;
+}
+
+void rs_chunk_set_free(rs_chunk_set *set)
+{
+  int i;
+
+  for (i = 0; i < RS_MAX_CHUNKS; i++) {
+    if (set->chunks[i].fd != -1) close(set->chunks[i].fd);
+    free(set->chunks[i].name);
+    free(set->chunks[i].table);
+    chunk_hash_free(set->chunks[i].digest);
+  }
+  rs_decoder_free(set->decoder);
+  free(set);
+}
+
+uint64_t rs_chunk_set_size(const rs_chunk_set *set)
+{
+  return set->orig_size;
+}
+
+const struct header *rs_chunk_set_header(const rs_chunk_set *set)
+{
+  return set->nchunks > 0 ? &set->hdr : NULL;
+}
+
+unsigned rs_chunk_set_hash_type(const rs_chunk_set *set)
+{
+  return set->layout.hash_type;
+}
+
+void rs_chunk_set_drop(rs_chunk_set *set, int chunknum)
+{
+  set->chunks[chunknum].bad = 1;
+}
+
+/* SHA1(header up to the chunk hash, digest) == chunk hash */
+static int chunk_hash_ok(struct header *h, unsigned hash_type,
+                         const unsigned char *digest)
+{
+  chunk_hash_ctx *ctx = chunk_hash_new(hash_type);
+  unsigned char tmp[20];
+
+  chunk_hash_update(ctx, h, offsetof(struct header, sha1_chunk_hash));
+  chunk_hash_update(ctx, digest, 20);
+  chunk_hash_final(ctx, tmp);
+  chunk_hash_free(ctx);
+  return memcmp(tmp, h->sha1_chunk_hash, 20) == 0;
+}
+
+/* SHA1(header_v2, table) */
+static void table_digest(const rs_chunk_set *set, const unsigned char *table,
+                         unsigned char *digest)
+{
+  chunk_hash_ctx *ctx = chunk_hash_new(set->layout.hash_type);
+
+  chunk_hash_update(ctx, &set->ext, sizeof(set->ext));
+  chunk_hash_update(ctx, table, 20 * set->layout.nhashblocks);
+  chunk_hash_final(ctx, digest);
+  chunk_hash_free(ctx);
+}
+
+int rs_chunk_set_add(rs_chunk_set *set, int fd, const char *name)
+{
+  struct header h;
+  struct header_v2 ext;
+  struct chunk_layout layout;
+  struct stat st;
+  struct rs_chunk *c;
+  unsigned char digest[20];
+  int chunknum;
+
+  memset(&ext, 0, sizeof(ext));
+  if (fstat(fd, &st) != 0 || rs_pread_full(fd, &h, sizeof(h), 0) != 0 ||
+      (h.version != 1 && rs_pread_full(fd, &ext, sizeof(ext), sizeof(h)) != 0)) {
+    fprintf(stderr, "%s: unable to read header: %s\n", name, strerror(errno));
+    return -1;
+  }
+  if (!chunk_layout_from_size(&h, &ext, st.st_size, &layout)) {
+    fprintf(stderr, "%s: unknown version %d or bad size\n", name, h.version);
+    return -1;
+  }
+  chunknum = getchunknum(&h);
+  if (getn(&h) == 0 || chunknum >= (int) (getn(&h) + getm(&h)) ||
+      layout.blocksize * getn(&h) < h.under_size) {
+    fprintf(stderr, "%s: bad header\n", name);
+    return -1;
+  }
+  if (set->nchunks == 0) {
+    set->hdr = h;
+    set->ext = ext;
+    set->layout = layout;
+    set->n = getn(&h);
+    set->m = getm(&h);
+    set->orig_size = layout.blocksize * set->n - h.under_size;
+  } else if (h.version != set->hdr.version || getn(&h) != (unsigned) set->n ||
+             getm(&h) != (unsigned) set->m || h.under_size != set->hdr.under_size ||
+             memcmp(&ext, &set->ext, sizeof(ext)) != 0 ||
+             layout.blocksize != set->layout.blocksize ||
+             memcmp(h.sha1_file_hash, set->hdr.sha1_file_hash, 20) != 0 ||
+             memcmp(h.sha1_crosschunk_hash, set->hdr.sha1_crosschunk_hash, 20) != 0) {
+    fprintf(stderr, "%s: header does not match the other chunks\n", name);
+    return -1;
+  }
+  c = &set->chunks[chunknum];
+  if (c->fd != -1) {
+    fprintf(stderr, "%s: duplicate chunk %d\n", name, chunknum);
+    return -1;
+  }
+
+  if (h.version != 1) {
+    c->table = (unsigned char *) malloc(20 * layout.nhashblocks + 1);
+    if (c->table == NULL) { perror("rs_chunk_set_add: malloc"); exit(1); }
+    if (rs_pread_full(fd, c->table, 20 * layout.nhashblocks,
+                      sizeof(h) + sizeof(ext)) != 0) {
+      fprintf(stderr, "%s: unable to read hash table: %s\n", name, strerror(errno));
+      free(c->table);
+      c->table = NULL;
+      return -1;
+    }
+    table_digest(set, c->table, digest);
+    if (!chunk_hash_ok(&h, layout.hash_type, digest)) {
+      fprintf(stderr, "%s: chunk hash did not verify\n", name);
+      free(c->table);
+      c->table = NULL;
+      return -1;
+    }
+  }
+  c->fd = fd;
+  c->bad = 0;
+  c->name = strdup(name);
+  c->hashed_upto = 0;
+  c->digest = chunk_hash_new(layout.hash_type);
+  set->nchunks++;
+  return chunknum;
+}
+
+static int chunk_usable(const rs_chunk_set *set, int i)
+{
+  return set->chunks[i].fd != -1 && !set->chunks[i].bad;
+}
+
+/* Reads a window of chunk i; version 1 chunks are hashed here, as
+   far as the windows come in order */
+static int read_window_data(rs_chunk_set *set, int i, uint64_t start, size_t len,
+                            unsigned char *buf)
+{
+  struct rs_chunk *c = &set->chunks[i];
+
+  if (rs_pread_full(c->fd, buf, len, set->layout.data_offset + start) != 0) {
+    fprintf(stderr, "%s: read error: %s\n", c->name, strerror(errno));
+    c->bad = 1;
+    return 0;
+  }
+  if (set->layout.hash_block_size == 0 && start == c->hashed_upto) {
+    chunk_hash_update(c->digest, buf, len);
+    c->hashed_upto += len;
+  }
+  return 1;
+}
+
+/* Version 2 on: checks the same window of the k chunks in chunks[]
+   against their block hashes, all at once; windows are aligned to
+   hash blocks.  Marks the ones that fail bad. */
+static int verify_windows(rs_chunk_set *set, const int *chunks, int k,
+                          uint64_t start, size_t len, unsigned char **bufs)
+{
+  size_t hbs = set->layout.hash_block_size, nb, b;
+  struct chunk_hash_job jobs[RS_MAX_CHUNKS];
+  unsigned char *digests;
+  struct rs_chunk *c;
+  int i, ok = 1;
+
+  if (hbs == 0 || k == 0) return 1;
+  nb = (len + hbs - 1) / hbs;
+  digests = (unsigned char *) malloc(20 * nb * k);
+  if (digests == NULL) { perror("verify_windows: malloc"); exit(1); }
+  for (i = 0; i < k; i++) {
+    jobs[i].data = bufs[i];
+    jobs[i].len = len;
+    jobs[i].digests = digests + 20 * nb * i;
+  }
+  chunk_hash_blocks(set->layout.hash_type, hbs, jobs, k, 0);
+  for (i = 0; i < k; i++) {
+    c = &set->chunks[chunks[i]];
+    for (b = 0; b < nb; b++) {
+      if (memcmp(jobs[i].digests + 20 * b, c->table + 20 * (start / hbs + b), 20) != 0) {
+        fprintf(stderr, "%s: block %lld did not verify\n", c->name,
+                (long long) (start / hbs + b));
+        c->bad = 1;
+        ok = 0;
+        break;
+      }
+    }
+  }
+  free(digests);
+  return ok;
+}
+
+/* Reads a window of chunk i and checks what can be checked */
+static int read_window(rs_chunk_set *set, int i, uint64_t start, size_t len,
+                       unsigned char *buf)
+{
+  return read_window_data(set, i, start, len, buf) &&
+    verify_windows(set, &i, 1, start, len, &buf);
+}
+
+/* Gets a window of chunk chunknum into out, directly or by decoding */
+static int get_window(rs_chunk_set *set, int chunknum, uint64_t start, size_t len,
+                      unsigned char *out, unsigned char *space)
+{
+  int rows = set->n + set->m, i, j, k, s, changed, read[RS_MAX_CHUNKS];
+  const uint8_t *sources[RS_MAX_CHUNKS];
+  unsigned char *bufs[RS_MAX_CHUNKS];
+
+ retry:
+  if (chunk_usable(set, chunknum)) {
+    if (read_window(set, chunknum, start, len, out)) return 1;
+  }
+  changed = set->decoder == NULL;
+  for (i = 0; i < rows; i++) {
+    if (set->decoder_present[i] != chunk_usable(set, i)) changed = 1;
+    set->decoder_present[i] = chunk_usable(set, i);
+  }
+  if (changed) {
+    rs_decoder_free(set->decoder);
+    set->decoder = rs_decoder_new(set->n, set->m, set->decoder_present);
+    if (set->decoder == NULL) {
+      fprintf(stderr, "unable to rebuild chunk %d: not enough usable chunks\n",
+              chunknum);
+      return 0;
+    }
+    if (set->verbose) {
+      fprintf(stderr, "rebuilding from chunks");
+      for (j = 0; j < set->n; j++) {
+        fprintf(stderr, " %d", rs_decoder_source(set->decoder, j));
+      }
+      fprintf(stderr, "\n");
+    }
+  }
+  /* read all the sources, then verify them together */
+  k = 0;
+  for (j = 0; j < set->n; j++) {
+    sources[j] = NULL;
+    if (rs_decoder_coefficient(set->decoder, chunknum, j) == 0) continue;
+    s = rs_decoder_source(set->decoder, j);
+    if (!read_window_data(set, s, start, len, space + (size_t) j * len)) {
+      goto retry;
+    }
+    sources[j] = space + (size_t) j * len;
+    read[k] = s;
+    bufs[k++] = space + (size_t) j * len;
+  }
+  if (!verify_windows(set, read, k, start, len, bufs)) goto retry;
+  rs_decode(set->decoder, sources, chunknum, out, len);
+  return 1;
+}
+
+/* Windows hold whole hash blocks, and for version 3 whole stripe
+   units, which are whole hash blocks */
+static size_t align_window(const rs_chunk_set *set, size_t window)
+{
+  size_t align = set->layout.stripe_unit > 0 ? set->layout.stripe_unit
+    : set->layout.hash_block_size;
+
+  if (window == 0) window = RS_STREAM_WINDOW_DEFAULT;
+  if (align > 0) window = (window + align - 1) / align * align;
+  return window;
+}
+
+int rs_decode_range(rs_chunk_set *set, uint64_t offset, uint64_t length,
+                    int out_fd, size_t window)
+{
+  uint64_t blocksize = set->layout.blocksize, pos, end, wstart;
+  unsigned long long co, run;
+  uint64_t chunk_start[RS_MAX_CHUNKS];
+  size_t wlen, take, out_used = 0, hbs = set->layout.hash_block_size;
+  unsigned char *chunk_bufs[RS_MAX_CHUNKS], *space = NULL, *out_buf = NULL;
+  unsigned char *chunk_buf;
+  unsigned char digest[20];
+  chunk_hash_ctx *file_ctx;
+  int whole, i, ret = -1;
+  unsigned c;
+
+  if (set->nchunks == 0) {
+    fprintf(stderr, "rs_decode_range: no chunks\n");
+    return -1;
+  }
+  window = align_window(set, window);
+  if (offset > set->orig_size) offset = set->orig_size;
+  end = length > set->orig_size - offset ? set->orig_size : offset + length;
+  whole = offset == 0 && end == set->orig_size;
+
+  if (posix_memalign((void **) &out_buf, 4096, window) != 0 ||
+      posix_memalign((void **) &space, 4096, (size_t) set->n * window) != 0) {
+    perror("rs_decode_range: malloc");
+    exit(1);
+  }
+  /* the window of each data chunk we have; allocated as needed */
+  for (i = 0; i < set->n; i++) {
+    chunk_bufs[i] = NULL;
+    chunk_start[i] = ~(uint64_t) 0;
+  }
+  file_ctx = chunk_hash_new(set->layout.hash_type);
+
+  for (pos = offset; pos < end; pos += take) {
+    run = chunk_locate(&set->layout, set->n, pos, &c, &co);
+    wstart = co / window * window;
+    wlen = blocksize - wstart > window ? window : blocksize - wstart;
+    if (chunk_bufs[c] == NULL &&
+        posix_memalign((void **) &chunk_bufs[c], 4096, window) != 0) {
+      perror("rs_decode_range: malloc");
+      exit(1);
+    }
+    chunk_buf = chunk_bufs[c];
+    if (chunk_start[c] != wstart) {
+      chunk_start[c] = ~(uint64_t) 0;
+      if (!get_window(set, c, wstart, wlen, chunk_buf, space)) goto out;
+      chunk_start[c] = wstart;
+    }
+    take = wstart + wlen - co;
+    if (take > run) take = run;
+    if (take > end - pos) take = end - pos;
+    if (whole) chunk_hash_update(file_ctx, chunk_buf + (co - wstart), take);
+    if (out_fd != -1) {
+      /* collect full windows of output so the writes are large */
+      size_t done = 0, amt;
+      while (done < take) {
+        amt = take - done > window - out_used ? window - out_used : take - done;
+        memcpy(out_buf + out_used, chunk_buf + (co - wstart) + done, amt);
+        out_used += amt;
+        done += amt;
+        if (out_used == window) {
+          if (write(out_fd, out_buf, out_used) != (ssize_t) out_used) {
+            perror("rs_decode_range: write");
+            goto out;
+          }
+          out_used = 0;
+        }
+      }
+    }
+  }
+  if (out_fd != -1 && out_used > 0 &&
+      write(out_fd, out_buf, out_used) != (ssize_t) out_used) {
+    perror("rs_decode_range: write");
+    goto out;
+  }
+
+  if (whole) {
+    chunk_hash_final(file_ctx, digest);
+    if (memcmp(digest, set->hdr.sha1_file_hash, 20) != 0) {
+      fprintf(stderr, "file hash did not verify\n");
+      goto out;
+    }
+    for (i = 0; i < set->n + set->m; i++) {
+      struct rs_chunk *ch = &set->chunks[i];
+      struct header h = set->hdr;
+      if (hbs != 0 || ch->fd == -1 || ch->hashed_upto != blocksize) continue;
+      chunk_hash_final(ch->digest, digest);
+      ch->hashed_upto = 0;
+      if (rs_pread_full(ch->fd, &h, sizeof(h), 0) != 0 ||
+          !chunk_hash_ok(&h, set->layout.hash_type, digest)) {
+        fprintf(stderr, "%s: chunk hash did not verify\n", ch->name);
+        goto out;
+      }
+    }
+    if (set->verbose) fprintf(stderr, "file hash verified\n");
+  }
+  ret = 0;
+
+ out:
+  free(out_buf);
+  for (i = 0; i < set->n; i++) free(chunk_bufs[i]);
+  free(space);
+  chunk_hash_free(file_ctx);
+  return ret;
+}
+
+/* Version 3: reads all the usable chunks a row of windows at a time;
+   the windows of the data chunks together are a contiguous piece of
+   the file, hashed in order if every data chunk is there. */
+static int check_striped(rs_chunk_set *set, size_t window, int ndata,
+                         chunk_hash_ctx *file_ctx)
+{
+  uint64_t blocksize = set->layout.blocksize, off;
+  unsigned long long pos, end, run, co;
+  size_t amt;
+  unsigned char *space = NULL, *bufs[RS_MAX_CHUNKS];
+  int i, k, rows = set->n + set->m, ret = -1, read[RS_MAX_CHUNKS];
+  unsigned c;
+
+  /* a window per chunk, so that they can be verified together */
+  if (posix_memalign((void **) &space, 4096, (size_t) rows * window) != 0) {
+    perror("rs_chunk_set_check: malloc");
+    exit(1);
+  }
+  for (off = 0; off < blocksize; off += amt) {
+    amt = blocksize - off > window ? window : blocksize - off;
+    for (i = k = 0; i < rows; i++) {
+      if (!chunk_usable(set, i)) continue;
+      if (!read_window_data(set, i, off, amt, space + (size_t) i * window)) goto out;
+      read[k] = i;
+      bufs[k++] = space + (size_t) i * window;
+    }
+    if (!verify_windows(set, read, k, off, amt, bufs)) goto out;
+    if (ndata < set->n) continue;
+    pos = chunk_file_offset(&set->layout, set->n, 0, off, &run);
+    end = off + amt == blocksize ? (uint64_t) set->n * blocksize
+      : chunk_file_offset(&set->layout, set->n, 0, off + amt, &run);
+    if (end > set->orig_size) end = set->orig_size;
+    for (; pos < end; pos += run) {
+      run = chunk_locate(&set->layout, set->n, pos, &c, &co);
+      if (run > end - pos) run = end - pos;
+      chunk_hash_update(file_ctx, space + (size_t) c * window + (co - off), run);
+    }
+  }
+  ret = 0;
+
+ out:
+  free(space);
+  return ret;
+}
+
+int rs_chunk_set_check(rs_chunk_set *set, size_t window)
+{
+  uint64_t blocksize = set->layout.blocksize, off, file_remain;
+  size_t amt, hbs = set->layout.hash_block_size;
+  unsigned char *buf = NULL, digest[20];
+  chunk_hash_ctx *file_ctx, *cross_ctx;
+  struct header h;
+  int i, rows = set->n + set->m, ndata = 0, nall = 0, ret = -1;
+
+  if (set->nchunks == 0) {
+    fprintf(stderr, "rs_chunk_set_check: no chunks\n");
+    return -1;
+  }
+  window = align_window(set, window);
+  if (posix_memalign((void **) &buf, 4096, window) != 0) {
+    perror("rs_chunk_set_check: malloc");
+    exit(1);
+  }
+  for (i = 0; i < rows; i++) {
+    if (!chunk_usable(set, i)) continue;
+    if (i < set->n) ndata++;
+    nall++;
+  }
+
+  file_ctx = chunk_hash_new(set->layout.hash_type);
+  cross_ctx = chunk_hash_new(set->layout.hash_type);
+  if (set->layout.stripe_unit > 0 && check_striped(set, window, ndata, file_ctx) != 0) {
+    goto out;
+  }
+  /* otherwise chunk by chunk in order, so the data chunks go by in
+     file order; then the chunk and crosschunk hashes */
+  file_remain = set->orig_size;
+  for (i = 0; i < rows; i++) {
+    struct rs_chunk *c = &set->chunks[i];
+    if (!chunk_usable(set, i)) continue;
+    chunk_hash_final(c->digest, digest); /* start over */
+    c->hashed_upto = 0;
+    for (off = 0; off < blocksize && set->layout.stripe_unit == 0; off += amt) {
+      amt = blocksize - off > window ? window : blocksize - off;
+      if (!read_window(set, i, off, amt, buf)) goto out;
+      if (i < set->n && ndata == set->n) {
+        size_t use = file_remain > amt ? amt : file_remain;
+        chunk_hash_update(file_ctx, buf, use);
+        file_remain -= use;
+      }
+    }
+    if (rs_pread_full(c->fd, &h, sizeof(h), 0) != 0) {
+      fprintf(stderr, "%s: unable to reread header\n", c->name);
+      goto out;
+    }
+    if (hbs == 0) {
+      chunk_hash_final(c->digest, digest);
+      c->hashed_upto = 0;
+      if (!chunk_hash_ok(&h, set->layout.hash_type, digest)) {
+        fprintf(stderr, "%s: chunk hash did not verify\n", c->name);
+        goto out;
+      }
+    } else {
+      /* the table was checked against the chunk hash when added */
+      table_digest(set, c->table, digest);
+    }
+    chunk_hash_update(cross_ctx, &h, offsetof(struct header, sha1_crosschunk_hash));
+    chunk_hash_update(cross_ctx, digest, 20);
+  }
+  if (ndata == set->n) {
+    chunk_hash_final(file_ctx, digest);
+    if (memcmp(digest, set->hdr.sha1_file_hash, 20) != 0) {
+      fprintf(stderr, "file hash did not verify\n");
+      goto out;
+    }
+  }
+  if (nall == rows) {
+    chunk_hash_final(cross_ctx, digest);
+    if (memcmp(digest, set->hdr.sha1_crosschunk_hash, 20) != 0) {
+      fprintf(stderr, "crosschunk hash did not verify\n");
+      goto out;
+    }
+  }
+  if (set->verbose) {
+    fprintf(stderr, "checked %d chunks%s%s\n", nall,
+            ndata == set->n ? ", file hash" : "", nall == rows ? ", crosschunk hash" : "");
+  }
+  ret = 0;
+
+ out:
+  free(buf);
+  chunk_hash_free(file_ctx);
+  chunk_hash_free(cross_ctx);
+  return ret;
+}
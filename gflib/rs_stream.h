@@ -0,0 +1,84 @@
+/*
+   (c) Copyright 2008, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+
+   Streaming encoder: turns a file into n+m chunk files (see header.h)
+   a window at a time, so memory use is (n+m) windows no matter how
+   big the file is.
+*/
+
+#ifndef RS_STREAM_H
+#define RS_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "header.h"
+
+#define RS_STREAM_WINDOW_DEFAULT (1024*1024)
+
+struct rs_encode_params {
+    int n, m;
+    int version;          /* 1 to 4 */
+    int hash_block_shift; /* versions 2 to 4 */
+    int stripe_shift;     /* version 3, and version 4 if not 0 */
+    int hash_type;        /* version 4: CHUNK_HASH_* */
+    size_t window;        /* bytes of each chunk per pass, 0 for the default */
+};
+
+/* Encodes the size bytes of in_fd into the n+m files open for writing
+   on out_fds, writing all of them as it goes.  If headers is not
+   NULL it gets the n+m final headers.  Returns 0 on success, or -1
+   after printing a message to stderr. */
+extern int rs_encode_stream(int in_fd, uint64_t size,
+                            const struct rs_encode_params *params,
+                            const int *out_fds, struct header *headers);
+
+/* Streaming decoder.  Chunk files are added one at a time and checked
+   against each other; rs_decode_range then writes any range of the
+   original file, a window at a time, reading data chunks directly
+   and rebuilding missing or corrupt ones from the others.  Memory use
+   is about 2n+1 windows plus the hash tables; a window of each data
+   chunk is kept so that striped (version 3) files are read one row of
+   stripe units at a time. */
+
+typedef struct rs_chunk_set rs_chunk_set;
+
+/* n+m is at most this */
+#define RS_MAX_CHUNKS 64
+
+extern rs_chunk_set *rs_chunk_set_new(int verbose);
+/* Takes ownership of fd on success; returns the chunk number, or -1
+   (and prints why) if the chunk is unusable or doesn't match the
+   chunks added before. */
+extern int rs_chunk_set_add(rs_chunk_set *set, int fd, const char *name);
+/* Treat chunk chunknum as missing, e.g. to verify recovery without it */
+extern void rs_chunk_set_drop(rs_chunk_set *set, int chunknum);
+extern uint64_t rs_chunk_set_size(const rs_chunk_set *set);
+/* The header of the first chunk added, NULL if none */
+extern const struct header *rs_chunk_set_header(const rs_chunk_set *set);
+/* The hash the chunks use, CHUNK_HASH_SHA1 unless version 4 */
+extern unsigned rs_chunk_set_hash_type(const rs_chunk_set *set);
+extern void rs_chunk_set_free(rs_chunk_set *set);
+
+/* Writes [offset, offset+length) of the original file to out_fd (or
+   nowhere if out_fd is -1).  Version 2 blocks are verified before
+   use; version 1 chunk hashes and the file hash can only be checked
+   once everything has been read, so they are checked at the end when
+   the range is the whole file and a mismatch is reported after the
+   data went out.  Returns 0 on success, -1 after printing a message. */
+extern int rs_decode_range(rs_chunk_set *set, uint64_t offset, uint64_t length,
+                           int out_fd, size_t window);
+
+/* Reads every present chunk in full and checks it against its hashes.
+   If all the data chunks are present the file hash is checked too,
+   and if all n+m chunks are present so is the crosschunk hash.
+   Returns 0 if everything checked out, -1 after printing why not. */
+extern int rs_chunk_set_check(rs_chunk_set *set, size_t window);
+
+/* pread/pwrite that retry until done; 0 on success, -1 with errno set
+   (EIO for an unexpected EOF) */
+extern int rs_pread_full(int fd, void *buf, size_t len, uint64_t offset);
+extern int rs_pwrite_full(int fd, const void *buf, size_t len, uint64_t offset);
+
+#endif
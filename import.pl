@@ -1,13 +1,10 @@
 #!/usr/bin/perl -w
 use strict;
-use threads;
-use threads::shared;
 use File::Find;
 use POSIX;
 use Digest::SHA1;
 use MIME::Base64;
 use FileHandle;
-use File::Copy;
 use File::Compare;
 use Filesys::Statvfs;
 use Fcntl ':flock';
@@ -20,18 +17,24 @@ $GLOBAL::debug = 0;
 
 my $files_under;
 my $base_dir;
-my $nthreads = 3;
+my $nthreads = 0; # let rs_import pick
+my $verify_recover = 0;
+my $layout_version = 3; # striped; see gflib/header.h
+my $hash = 'sha256'; # version 4 only; see gflib/chunk_hash.h
+my $rs_index = "$ENV{HOME}/projects/eccfs/gflib/rs_index";
 
 my $ret = GetOptions("path=s" => \$files_under,
 		     "base=s" => \$base_dir,
-		     "threads=i" => \$nthreads);
+		     "threads=i" => \$nthreads,
+		     "verify-recover!" => \$verify_recover,
+		     "layout-version=i" => \$layout_version,
+		     "hash=s" => \$hash);
 usage("missing arguments.")
     unless $ret && @ARGV == 1 && -d $ARGV[0];
 
 my $eccfsdir = $ARGV[0];
 
-my($lock, $rs_encode_file, $rs_decode_file, $workbase, $encodedir,
-   $decodedir, $importdir, @eccdirs) = setup();
+my($lock, $rs_import, $workbase, $importdir, @eccdirs) = setup();
 
 if (defined $files_under) {
     $base_dir ||= "";
@@ -43,47 +46,139 @@ if (defined $files_under) {
 # only has to specify the fixup rule once.
 
 my %reverify_directories;
-my %reverify_files : shared;
-my %fixup_decisions : shared; # this may not need to be shared
-
-my @pending_imports : shared;
-my $done : shared;
-$done = 0;
-my @threads;
-for(my $i=0; $i < $nthreads; ++$i) {
-    push(@threads, threads->create(sub { importerThread($i) }));
-}
+my %reverify_files;
+my %fixup_decisions;
+my $index_rescan = 0; # a fixup renamed something, so rebuild the chunk indexes
+
+# Free bytes in each eccdir.  Nothing is written until rs_import runs
+# the jobs, so each dir is statted once and handlefile takes off what
+# each job will put there; statting for every file would send every
+# file to the same dirs.
+my %freespace;
+
+# The daemon's encoder owns the files written through the mount until
+# it has encoded them; they are named in its journal in each eccdir
+# (see ImportEncoder.H), and are left to it.
+my %encoder_owned = encoderJournaled();
+my %left_to_encoder;
+
+my @files;
 find(\&wanted, $importdir);
-{
-    lock(@pending_imports);
-    $done = 1;
-    cond_broadcast(@pending_imports);
+
+# Files that are copies of ones already imported, going by the size
+# and SHA1 in the content tables rs_index writes beside the chunk
+# indexes (see gflib/chunk_index.h), are handed to the daemon through
+# .dedup; its encoder makes them references to the imported copy's
+# chunks rather than encoding them again, and removes them from the
+# importdir itself.  The path names the layout they would be imported
+# as, which the encoder uses instead should one no longer be a copy
+# by the time it gets to it.  A daemon that can't take them just gets
+# them imported.
+my %handed_off;
+if (@files) {
+    print "Looking for copies among " . scalar(@files) . " files...\n";
+    my $copy_jobs = "$workbase/copy-jobs";
+    open(JOBS, ">$copy_jobs") or die "Can't create $copy_jobs: $!";
+    foreach my $subname (@files) {
+	print JOBS join("\t", "C", $subname, "/$subname", "$importdir/$subname"), "\n";
+    }
+    close(JOBS) or die "Can't write $copy_jobs: $!";
+    my $copies = runImporter($copy_jobs);
+    unlink($copy_jobs) or die "Can't remove $copy_jobs: $!";
+    foreach my $subname (@files) {
+	my $result = $copies->{$subname};
+	next unless defined $result && $result =~ /^copy\t(.*)$/o;
+	my $copy_of = $1;
+	my $layout = join(",", determineNM($subname), $layout_version, $hash);
+	my @ret = stat("$eccfsdir/.dedup/$layout/$subname");
+	if (@ret == 0 && $! eq 'Numerical result out of range') {
+	    print "copy $subname of $copy_of handed to eccfs\n";
+	    $handed_off{$subname} = 1;
+	} else {
+	    print "copy $subname of $copy_of not taken by eccfs ($!), importing it\n";
+	}
+    }
+}
+
+# Files are queued as jobs for rs_import (see gflib/rs_import.c), which
+# encodes each one straight into its eccdirs, verifies the chunks and
+# fsyncs and renames them into place on a pool of threads.
+my %pending_imports;
+my $import_jobs = "$workbase/import-jobs";
+open(JOBS, ">$import_jobs") or die "Can't create $import_jobs: $!";
+foreach my $subname (@files) {
+    queueImport($subname) unless $handed_off{$subname};
 }
-print "Waiting for importers to finish...\n";
-foreach my $thread (@threads) {
-    my $ret = $thread->join();
-    die "import thread failed??" unless $ret;
+close(JOBS) or die "Can't write $import_jobs: $!";
+
+print "Importing " . scalar(keys %pending_imports) . " files...\n";
+my @importer_args = ("-v", $layout_version);
+push(@importer_args, "-H", $hash) if $layout_version >= 4;
+push(@importer_args, "-V", 2) if $verify_recover;
+my $results = runImporter($import_jobs, @importer_args);
+my $failed = 0;
+foreach my $subname (sort keys %pending_imports) {
+    my $result = $results->{$subname};
+    $result = "no result from rs_import" unless defined $result;
+    if ($result ne 'ok') {
+	warn "Import of $subname failed: $result";
+	++$failed;
+	next;
+    }
+    my ($n, $m, @eccusedirs) = @{$pending_imports{$subname}};
+    my %inuse = map { ($_ => 1) } @eccusedirs;
+    # the new chunks replaced any old ones in @eccusedirs; drop the rest
+    foreach my $eccdir (@eccdirs) {
+	next if $inuse{$eccdir} || ! -f "$eccdir/$subname";
+	unlink("$eccdir/$subname") or die "Can't remove $eccdir/$subname: $!";
+    }
+    $reverify_files{$subname} = $pending_imports{$subname};
 }
-die "??" unless @pending_imports == 0;
-rmdir($encodedir) or die "Can't rmdir $encodedir: $!";
-rmdir($decodedir) or die "Can't rmdir $decodedir: $!";
+die "$failed files failed to import" if $failed;
+unlink($import_jobs) or die "Can't remove $import_jobs: $!";
+
+# The daemon finds chunks through the index in each eccdir, and rereads
+# them when told about the new files through .just-imported below.
+print "Updating chunk indexes...\n";
+updateIndexes(keys %reverify_directories, keys %reverify_files);
 
 print "Syncing filesystem...\n";
 system("sync") == 0 
     or die "sync failed: $!";
 
 print "Reverifying files...\n";
+my $verify_jobs = "$workbase/verify-jobs";
+open(JOBS, ">$verify_jobs") or die "Can't create $verify_jobs: $!";
+foreach my $subname (sort keys %reverify_files) {
+    my ($n, $m, @eccusedirs) = @{$reverify_files{$subname}};
+    print JOBS join("\t", "V", $subname, "$importdir/$subname",
+		    map { "$_/$subname" } @eccusedirs), "\n";
+}
+close(JOBS) or die "Can't write $verify_jobs: $!";
+my $verified = runImporter($verify_jobs);
+unlink($verify_jobs) or die "Can't remove $verify_jobs: $!";
+
 foreach my $subname (sort keys %reverify_files) {
     print "   verify $subname\n";
     my ($n, $m, @eccusedirs) = @{$reverify_files{$subname}};
-    my %inuse;
-    my @eccfiles = map { $inuse{$_} = 1; "$_/$subname" } @eccusedirs;
+    my %inuse = map { ($_ => 1) } @eccusedirs;
     foreach my $eccdir (@eccdirs) {
 	next if $inuse{$eccdir};
 	die "Incorrectly still existing file $eccdir/$subname"
 	    if -f "$eccdir/$subname";
     }
-    verifyEccSplitup('xx', $decodedir, "$importdir/$subname", \@eccfiles, $n, $m, 0);
+    my $result = $verified->{$subname};
+    die "Reverify of $subname failed: " . (defined $result ? $result : "no result")
+	unless defined $result && $result eq 'ok';
+
+    # Written through the mount while we imported it, so the encoder
+    # has the importdir copy, which is what eccfs reads
+    %encoder_owned = encoderJournaled();
+    if ($encoder_owned{$subname}) {
+	print "   $subname now being written through eccfs, leaving it to the encoder\n";
+	$left_to_encoder{$subname} = 1;
+	next;
+    }
 
     # Tell eccfs that we have just imported $subname
     my @ret = stat("$eccfsdir/.just-imported/$subname");
@@ -110,12 +205,20 @@ foreach my $subname (sort keys %reverify_files) {
 	unless $digest eq $eccdigest;
 }
 
+# the encoder removes the directories it empties
+my %busy_directories;
+foreach my $subname (keys %handed_off, keys %left_to_encoder) {
+    while ($subname =~ s!/[^/]*$!!o) {
+	$busy_directories{$subname} = 1;
+    }
+}
+
 print "Reverifying directories...\n";
 foreach my $subname (reverse sort keys %reverify_directories) {
     foreach my $eccdir (@eccdirs) {
 	die "??" unless -d "$eccdir/$subname";
     }
-    next if $subname eq '';
+    next if $subname eq '' || $busy_directories{$subname};
 
     rmdir("$importdir/$subname")
 	or die "Can't rmdir $importdir/$subname: $!";
@@ -139,20 +242,19 @@ sub setup {
 	    unless $lines[0] =~ /^1 (\d+)$/o;
 	my $neccdirs = $1;
 	shift @lines;
-	die "??" . scalar (@lines) . " != 1+$neccdirs" unless @lines == 1+$neccdirs;
+	# newer daemons append cache statistics after the directories
+	die "??" . scalar (@lines) . " < 1+$neccdirs" unless @lines >= 1+$neccdirs;
 	$importdir = shift @lines;
-	@eccdirs = @lines;
+	@eccdirs = @lines[0 .. $neccdirs-1];
 	close(MAGIC);
     }
     
     usage("importdir '$importdir' not a dir") unless -d $importdir;
     map { usage("eccdir $_ not a dir") unless -d $_; } @eccdirs;
     
-    my $rs_encode_file = "$ENV{HOME}/projects/eccfs/gflib/rs_encode_file";
-    die "$rs_encode_file not executable" unless -x $rs_encode_file;
-    
-    my $rs_decode_file = "$ENV{HOME}/projects/eccfs/gflib/rs_decode_file";
-    die "$rs_decode_file not executable" unless -x $rs_decode_file;
+    my $rs_import = "$ENV{HOME}/projects/eccfs/gflib/rs_import";
+    die "$rs_import not executable" unless -x $rs_import;
+    die "$rs_index not executable" unless -x $rs_index;
     
     my $workbase = "/tmp/workdir";
     unless (-d $workbase) {
@@ -161,32 +263,7 @@ sub setup {
     my $lock = getlock("$workbase/lock",60);
     die "Could not get lock file; another import is running??"
 	unless defined $lock;
-    my $encodedir = "$workbase/encode";
-    if (-d $encodedir) {
-	opendir(DIR, $encodedir) or die "noopendir $encodedir: $!";
-	while(my $file = readdir(DIR)) {
-	    next unless $file =~ /^ecc/o;
-	    unlink("$encodedir/$file")
-		or die "can't remove $encodedir/$file: $!";
-	}
-	closedir(DIR);
-    } else {
-	mkdir($encodedir, 0770) or die "Can't mkdir $encodedir: $!";
-    }
-    my $decodedir = "$workbase/decode";
-    if (-d $decodedir) {
-	opendir(DIR, $decodedir) or die "noopendir $decodedir: $!";
-	while(my $file = readdir(DIR)) {
-	    next unless $file =~ /^decode/o;
-	unlink("$decodedir/$file")
-	    or die "can't remove $decodedir/$file: $!";
-	}
-	closedir(DIR);
-    } else {
-	mkdir($decodedir, 0770) or die "Can't mkdir $decodedir: $!";
-    }
-    return ($lock, $rs_encode_file, $rs_decode_file, $workbase,
-	    $encodedir, $decodedir, $importdir, @eccdirs);
+    return ($lock, $rs_import, $workbase, $importdir, @eccdirs);
 }
 
 sub wanted {
@@ -194,6 +271,16 @@ sub wanted {
     $subname =~ s!^$importdir!!o or die "?? $File::Find::name";
     $subname =~ s!^/+!!o;
     print "Wanted ($File::Find::name) -> $subname\n" if $GLOBAL::debug;
+    if ($_ =~ /^\.eccfs-/o) {
+	# the daemon's own, such as the temporary copies it decodes into
+	$File::Find::prune = 1;
+	return;
+    }
+    if ($encoder_owned{$subname}) {
+	print "  leaving $subname to the eccfs encoder\n";
+	$left_to_encoder{$subname} = 1;
+	return;
+    }
     if (-l $File::Find::name) {
 	warn "importing symlink $File::Find::name as a file"
 	    unless defined $files_under;
@@ -223,6 +310,7 @@ sub handledir {
 	    } elsif ($t->[0] eq 'rename') {
 		rename("$eccdir/$subname","$eccdir/$t->[1]")
 		    or die "Can't rename $eccdir/$subname to $eccdir/$t->[1]: $!";
+		$index_rescan = 1;
 	    }
 	}
 	mkdir("$eccdir/$subname",0777) or die "Can't mkdir $eccdir/$subname: $!";
@@ -233,59 +321,11 @@ sub handledir {
 sub handlefile {
     my($subname) = @_;
 
-    # TODO: consider doing a bit of waiting if @pending_imports is really long
-    lock(@pending_imports);
-    push(@pending_imports, $subname);
-    cond_signal(@pending_imports);
-}
-
-sub getPending {
-    lock(@pending_imports);
-    while(1) {
-	return shift @pending_imports
-	    if @pending_imports > 0;
-	return undef if $done;
-	cond_wait(@pending_imports);
-    }
-}
-
-sub importerThread {
-    my ($threadid) = @_;
-
-    print "Start importer thread #$threadid...\n";
-    while(1) {
-	my $file = getPending();
-	last unless defined $file;
-	importfile($file, $threadid);
-    }
-    lock(@pending_imports);
-    die "??" unless $done;
-    print "Finish importer thread #$threadid...\n";
-    return 1;
-}
-
-sub importfile {
-    my($subname, $threadid) = @_;
-
     print "  handleFile($subname)\n" if $GLOBAL::debug;
 
-    my ($n,$m) = determineNM($subname);
-    print "import $subname as ($n,$m)\n";
-    my $max = @eccdirs;
-    die "Unable to import $subname, should be broken into $n data and $m parity pieces, but only $max places available"
-	unless $n + $m <= $max;
-
-    my $import_size = -s "$importdir/$subname";
-    my @eccusedirs = selectEccDirs($n, $m);
-    die "huh" . scalar @eccusedirs unless @eccusedirs == $n + $m;
-    my $q_subname = quotemeta($subname);
-    my $ret = system("$rs_encode_file $importdir/$q_subname $n $m $encodedir/ecc-t$threadid >/dev/null 2>&1");
-    die "Encoding of $subname failed?"
-	unless $ret == 0;
-    
-    my $eccsize = 4+20+20 + POSIX::ceil($import_size / $n); # header + datasize
-    my @eccfiles = map { sprintf("%s/ecc-t$threadid-%04d.rs", $encodedir, $_) } (0 .. $n+$m - 1);
-    verifyEccSplitup($threadid, $decodedir, "$importdir/$subname", \@eccfiles, $n, $m, 1);
+    # rs_import jobs are tab separated lines
+    die "Unable to import '$subname', tabs and newlines in names are unsupported"
+	if $subname =~ /[\t\n]/o;
 
     # Don't have to worry about parent directories as they would already have been processed by
     # handledir when handling importing of the parent
@@ -293,10 +333,11 @@ sub importfile {
     my $warned = 0;
     foreach my $eccdir (@eccdirs) {
 	if (-f "$eccdir/$subname") {
+	    # replaced by the rename in rs_import, or removed once the
+	    # import has succeeded
 	    warn "WARNING: overwriting $subname, might not successfully create new version"
 		unless $warned;
 	    $warned = 1;
-	    unlink("$eccdir/$subname");
 	} elsif (-d "$eccdir/$subname") {
 	    my $t = getFixup($subname, "$eccdir/$subname is a directory, but $importdir/$subname is a file.");
 	    if ($t->[0] eq 'delete') {
@@ -304,48 +345,108 @@ sub importfile {
 	    } elsif ($t->[0] eq 'rename') {
 		rename("$eccdir/$subname","$eccdir/$t->[1]")
 		    or die "Can't rename $eccdir/$subname to $eccdir/$t->[1]: $!";
+		$index_rescan = 1;
 	    } else {
 		die "internal";
 	    }
 	}
     }
+    push(@files, $subname);
+}
+
+sub queueImport {
+    my($subname) = @_;
+
+    my ($n,$m) = determineNM($subname);
+    print "import $subname as ($n,$m)\n";
+    my $max = @eccdirs;
+    die "Unable to import $subname, should be broken into $n data and $m parity pieces, but only $max places available"
+	unless $n + $m <= $max;
+
+    my @eccusedirs = selectEccDirs($n, $m);
+    die "huh" . scalar @eccusedirs unless @eccusedirs == $n + $m;
+    my $chunk_bytes = int(((-s "$importdir/$subname") + $n - 1) / $n);
+    map { $freespace{$_} -= $chunk_bytes } @eccusedirs;
+
+    print JOBS join("\t", "I", $subname, $n, $m, "$importdir/$subname",
+		    map { "$_/$subname" } @eccusedirs), "\n";
+    $pending_imports{$subname} = [$n, $m, @eccusedirs];
+}
 
-    die "??" unless @eccusedirs == $n + $m;
-    my $i = 0;
-    foreach my $eccdir (@eccusedirs) {
-	my $from = sprintf("%s/ecc-t$threadid-%04d.rs", $encodedir, $i);
-	copy($from, "$eccdir/$subname")
-	    or die "Unable to copy $from to $eccdir/$subname: $!";
-	++$i;
-	# this is just unlinking the temporary ecc working stuff ...
-	unlink($from) or die "Unable to unlink $from: $!";
+# The paths, relative to the importdir, that any eccdir's encode journal
+# says are still to be encoded: "W <layout> <path>" records not
+# followed by "D <path>", with \\ and \n escaped in the paths.
+sub encoderJournaled {
+    my %owned;
+    foreach my $eccdir (@eccdirs) {
+	my %journaled;
+	open(JOURNAL, "$eccdir/.eccfs-encode-journal") or next;
+	while (<JOURNAL>) {
+	    next unless chomp; # torn by a crash
+	    if (/^D (.*)$/o) {
+		delete $journaled{unescapePath($1)};
+	    } elsif (/^W \d+ \d+ \d+ \d+ \d+ \d+ (.*)$/o) {
+		$journaled{unescapePath($1)} = 1;
+	    }
+	}
+	close(JOURNAL);
+	map { s!^/+!!o; $owned{$_} = 1 } keys %journaled;
     }
-    
-    # Interestingly, the evidence is that this makes the import run
-    # faster; presumably it's managing to overlap more of the I/Os.
-
-    foreach my $eccdir (@eccusedirs) {
-  	my $tmp = new FileHandle("+<$eccdir/$subname")
-  	    or die "bad $eccdir/$subname: $!";
-  	my $tmp2 = new IO::Handle;
-  	$tmp2->fdopen(fileno($tmp),"w");
-	$tmp2->sync() or die "bad: $!";
-  	$tmp->close();
+    return %owned;
+}
+
+sub unescapePath {
+    my ($path) = @_;
+    $path =~ s/\\(.)/$1 eq 'n' ? "\n" : $1/ge;
+    return $path;
+}
+
+# Runs rs_import over a file of jobs; returns a hash of tag -> 'ok',
+# "copy\t<path>" for a C job that found a copy, or the error message.
+sub runImporter {
+    my ($jobfile, @args) = @_;
+
+    push(@args, "-t", $nthreads) if $nthreads > 0;
+    my $cmd = join(" ", $rs_import, @args, map { quotemeta($_) } @eccdirs);
+    open(IMPORTER, "$cmd < " . quotemeta($jobfile) . " |")
+	or die "Can't run $rs_import: $!";
+    my %results;
+    while (<IMPORTER>) {
+	chomp;
+	my ($status, $tag, $msg) = split(/\t/o, $_, 3);
+	if ($status eq 'ok') {
+	    print "  imported $tag\n" if $GLOBAL::debug;
+	    $results{$tag} = 'ok';
+	} elsif ($status eq 'copy') {
+	    $results{$tag} = "copy\t$msg";
+	} else {
+	    $results{$tag} = defined $msg ? $msg : $_;
+	}
     }
+    close(IMPORTER);
+    die "$rs_import failed: $?" unless $? == 0;
+    return \%results;
+}
+
+# Redoes the chunk index entries for @subnames in every eccdir, or
+# rebuilds the indexes from scratch if a fixup renamed something.
+sub updateIndexes {
+    my @subnames = @_;
 
-    die "internal $i != $n + $m" unless $i == $n + $m;
-    lock(%reverify_files);
-    # This works, oddly you can't &share(['f','g','h'])
-    my $tmp = &share([]);
-    @$tmp = ($n, $m, @eccusedirs);
-    $reverify_files{$subname} = $tmp;
+    my $cmd = join(" ", $rs_index, $index_rescan ? () : ("-u"),
+		   map { quotemeta($_) } @eccdirs);
+    if ($index_rescan) {
+	system($cmd) == 0 or die "$rs_index failed: $?";
+	return;
+    }
+    open(INDEXER, "| $cmd") or die "Can't run $rs_index: $!";
+    print INDEXER map { "$_\n" } @subnames;
+    close(INDEXER) or die "$rs_index failed: $?";
 }
 
 sub getFixup {
     my($subname, $msg) = @_;
 
-    lock(%fixup_decisions);
-    lock(@pending_imports); # lock this to make other threads not print stuff out
     while (! defined $fixup_decisions{$subname}) {
 	print "$msg\n";
 	print "what do you want to do with existing $subname: abort, delete, or rename [abort]?";
@@ -395,196 +496,19 @@ sub existsAnyEcc {
 
 
 sub usage {
-    die "$_[0]\nUsage: $0 [--threads=#] <eccfs-mount-point>"
-}
-
-sub verifyEccSplitup {
-    my($threadid, $decodedir, $dataname, $files, $n, $m, $verify_level) = @_;
-
-    print "verifyEccSplitup($dataname, [ " . join(", ", @$files) . "], $n, $m)\n"
-	if $GLOBAL::debug;
-    my $size = -s $dataname;
-
-    my $fh = new FileHandle($dataname) 
-	or die "Unable to open $dataname for read: $!";
-    my $sha1 = Digest::SHA1->new;
-    my $bytes_read = 0;
-    while (1) {
-	my $buffer;
-	my $amt = sysread($fh, $buffer, 262144);
-	die "Read failed: $!" unless defined $amt && $amt >= 0;
-	last if $amt == 0;
-	$sha1->add($buffer);
-	$bytes_read += $amt;
-    }
-    die "Size mismatch?? $size != $bytes_read" 
-	unless $size == $bytes_read;
-    $fh->close();
-
-    my $file_digest = $sha1->digest();
-    
-    my $rounded_size = $n * POSIX::ceil($size/$n);
-    my $under_size = $rounded_size - $size;
-    die "??" unless $under_size >= 0 && $under_size < 256;
-
-    my $sha1_crosschunk = new Digest::SHA1;
-    my $sha1_filehash = new Digest::SHA1;
-    my $crosschunk_hash;
-    for(my $i=0; $i < @$files; ++$i) {
-	my $tmp = verifyFile($i, $under_size, $rounded_size / $n, $n, $m, 
-			     $file_digest, $files->[$i], $sha1_crosschunk, $sha1_filehash);
-	$crosschunk_hash = $tmp unless defined $crosschunk_hash;
-	die "Crosschunk hash mismatch" unless $crosschunk_hash eq $tmp;
-    }
-
-    my $file_digest_over_chunks = $sha1_filehash->digest();
-    die "Mismatch between digest calculated over file ecc chunks and file digest: " .
-	unpack("H*",$file_digest_over_chunks) . " != " . unpack("H*",$file_digest)
-	unless $file_digest eq $file_digest_over_chunks;
-    my $crosschunk_digest_over_chunks = $sha1_crosschunk->digest();
-    die "Mismatch between crosschunk_digest calculated over chunks and stored digest: " .
-	unpack("H*",$crosschunk_digest_over_chunks) . " != " . unpack("H*",$crosschunk_hash)
-	unless $crosschunk_digest_over_chunks eq $crosschunk_hash;
-    
-    return if $verify_level == 0;
-
-    for(my $remove_start = 0; $remove_start < $n; ++$remove_start) {
-	my @recover_from = @$files;
-	for (my $j = $remove_start; $j < $remove_start + $m; ++$j) {
-	    $recover_from[$j] = undef;
-	}
-	print "verifyRecover(skip $remove_start for $m)\n"
-	    if $GLOBAL::debug;
-	verifyRecover($threadid, $decodedir, \@recover_from, $size, $file_digest);
-    }
-}
-
-sub verifyFile {
-    my($chunknum, $under_size, $chunk_size, $n, $m, $file_digest, $chunkname,
-       $sha1_crosschunk, $sha1_filehash) = @_;
-
-    print "    verifyFile($chunknum, $chunkname)..." if $GLOBAL::debug;
-    my $fh = new FileHandle($chunkname) 
-	or die "Unable to open $chunkname for read: $!";
-    
-    my $header;
-    my $amt = sysread($fh, $header, 4+3*20);
-
-    die "read bad" unless 4+3*20 == $amt;
-    my($version, $f_under_size, $f_info) = unpack("CCn", $header);
-    
-    die "Bad version $version != 1" 
-	unless 1 == $version;
-    die "Bad under size $f_under_size != $under_size" 
-	unless $f_under_size == $under_size;
-
-    my $f_n = $f_info >> 11;
-    my $f_m = ($f_info >> 6) & 0x1F;
-    my $f_chunknum = $f_info & 0x3F;
-    
-    die "Bad file_n $f_n != $n" 
-	unless $f_n == $n;
-    die "Bad file_m $f_m != $m"
-	unless $f_m == $m;
-    confess "Bad file_chunknum $f_chunknum != $chunknum from $chunkname"
-	unless $f_chunknum == $chunknum;
-
-    my $f_file_digest = substr($header, 4, 20);
-    die "Bad file hash " . unpack("H*",$f_file_digest) . " != " . unpack("H*", $file_digest)
-	unless $f_file_digest eq $file_digest;
-    my $f_crosschunk_hash = substr($header, 4+20, 20);
-    my $f_chunk_digest = substr($header, 4+2*20, 20);
-
-    my $sha1 = new Digest::SHA1;
-
-    my $bytes_read = 0;
-    my $filesize = $n * $chunk_size - $under_size;
-    my $filedata_remain = $filesize - $chunknum * $chunk_size;
-    while (1) {
-	my $buffer;
-	$amt = sysread($fh, $buffer, 262144);
-	die "Read failed: $!" unless defined $amt && $amt >= 0;
-	last if $amt == 0;
-	$sha1->add($buffer);
-	if ($filedata_remain > length($buffer)) {
-	    $sha1_filehash->add($buffer);
-	} elsif ($filedata_remain > 0) {
-	    $sha1_filehash->add(substr($buffer, 0, $filedata_remain));
-	} else {
-	    # ignore, not part of file data...
-	}
-	$bytes_read += $amt;
-	$filedata_remain -= $amt;
-    }
-    die "Didn't get proper number of bytes from reading chunk; $bytes_read != $chunk_size"
-	unless $bytes_read == $chunk_size;
-
-    my $filechunk_digest = $sha1->digest();
-    
-    $sha1->reset();
-    $sha1->add(substr($header, 0, 4+2*20), $filechunk_digest);
-    my $chunk_digest = $sha1->digest();
-    die "Bad chunk hash " . unpack("H*",$f_chunk_digest) . " != " . unpack("H*",$chunk_digest)
-	unless $f_chunk_digest eq $chunk_digest;
-    print "ok\n" if $GLOBAL::debug;
-
-    $sha1_crosschunk->add(substr($header, 0, 4+20), $filechunk_digest);
-
-    return $f_crosschunk_hash;
-}
-
-sub verifyRecover {
-    my($threadid, $decodedir, $recover_from, $expected_size, $file_digest) = @_;
-
-    for(my $i=0;$i<@$recover_from; ++$i) {
-	my $file = $recover_from->[$i];
-	next unless defined $file;
-	die "$file doesn't exist??" unless -f $file;
-	my $target = sprintf("%s/decode-t$threadid-%04d.rs",$decodedir, $i);
-	die "$target already exists" if -e $target || -l $target;
-	symlink($file, $target) 
-	    || die "Unable to symlink $file to $target";
-    }
-    my $fh = new FileHandle "$rs_decode_file $decodedir/decode-t$threadid 2>/dev/null |"
-	or die "Can't run $rs_decode_file $decodedir/decode: $!";
-    my $sha1 = Digest::SHA1->new;
-    my $bytes_read = 0;
-    while (1) {
-	my $buffer;
-	my $amt = sysread($fh, $buffer, 262144);
-	die "Read failed: $!" unless defined $amt && $amt >= 0;
-	last if $amt == 0;
-	$sha1->add($buffer);
-	$bytes_read += $amt;
-    }
-    close($fh)
-	or die "close failed: $!";
-    die "exit code of '$rs_decode_file $decodedir/decode' not 0" 
-	unless $? == 0;
-    die "Unexpected size of decode: $bytes_read != $expected_size"
-	unless $bytes_read == $expected_size;
-    my $digest = $sha1->digest();
-    die "Invalid digest " . unpack("H*", $file_digest) . " != " . unpack("H*", $digest)
-	unless $file_digest eq $digest;
-
-    for(my $i=0;$i<@$recover_from; ++$i) {
-	my $file = $recover_from->[$i];
-	next unless defined $file;
-	my $target = sprintf("%s/decode-t$threadid-%04d.rs",$decodedir, $i);
-	unlink($target)
-	    or die "Unable to unlink $target: $!";
-    }
+    die "$_[0]\nUsage: $0 [--threads=#] [--verify-recover] [--layout-version=1|2|3|4] [--hash=sha1|sha256|blake2s] <eccfs-mount-point>"
 }
 
 sub pickMostFree {
     my ($from_dirs, $count) = @_;
 
     return () if $count == 0;
-    my %freespace;
     map { 
-	my ($bsize, $frsize, $blocks, $bfree, $bavail,
-	    $files, $ffree, $favail, $flag, $namemax) = statvfs($_);
-	$freespace{$_} = $bavail * $bsize;
+	unless (defined $freespace{$_}) {
+	    my ($bsize, $frsize, $blocks, $bfree, $bavail,
+		$files, $ffree, $favail, $flag, $namemax) = statvfs($_);
+	    $freespace{$_} = $bavail * $frsize;
+	}
     } @$from_dirs;
     my @sorted = sort { $freespace{$b} <=> $freespace{$a} } @$from_dirs;
     return @sorted[0 .. $count - 1];
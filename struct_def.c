@@ -3,8 +3,10 @@
 int eccfs_getattr(const char *path, struct stat *stbuf);
 int eccfs_access(const char *path, int mask);
 int eccfs_readlink(const char *path, char *buf, size_t size);
+int eccfs_opendir(const char *path, struct fuse_file_info *fi);
 int eccfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 		off_t offset, struct fuse_file_info *fi);
+int eccfs_releasedir(const char *path, struct fuse_file_info *fi);
 int eccfs_mknod(const char *path, mode_t mode, dev_t rdev);
 int eccfs_mkdir(const char *path, mode_t mode);
 int eccfs_unlink(const char *path);
@@ -19,15 +21,28 @@ int eccfs_utime(const char *path, struct utimbuf *buf);
 int eccfs_open(const char *path, struct fuse_file_info *fi);
 int eccfs_read(const char *path, char *buf, size_t size, off_t offset,
 	     struct fuse_file_info *fi);
+#if FUSE_USE_VERSION >= 29
+int eccfs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+		   off_t offset, struct fuse_file_info *fi);
+#endif
 int eccfs_write(const char *path, const char *buf, size_t size,
 	      off_t offset, struct fuse_file_info *fi);
 int eccfs_statfs(const char *path, struct statvfs *stbuf);
+int eccfs_release(const char *path, struct fuse_file_info *fi);
+int eccfs_fsync(const char *path, int datasync, struct fuse_file_info *fi);
+#if FUSE_USE_VERSION >= 26
+void *eccfs_init(struct fuse_conn_info *conn);
+#else
+void *eccfs_init(void);
+#endif
 
 struct fuse_operations eccfs_oper = {
     .getattr	= eccfs_getattr,
     .access	= eccfs_access,
     .readlink	= eccfs_readlink,
+    .opendir	= eccfs_opendir,
     .readdir	= eccfs_readdir,
+    .releasedir	= eccfs_releasedir,
     .mknod	= eccfs_mknod,
     .mkdir	= eccfs_mkdir,
     .symlink	= eccfs_symlink,
@@ -41,7 +56,13 @@ struct fuse_operations eccfs_oper = {
     .utime	= eccfs_utime,
     .open	= eccfs_open,
     .read	= eccfs_read,
+#if FUSE_USE_VERSION >= 29
+    .read_buf	= eccfs_read_buf,
+#endif
     .write	= eccfs_write,
     .statfs	= eccfs_statfs,
+    .release	= eccfs_release,
+    .fsync	= eccfs_fsync,
+    .init	= eccfs_init,
 };
 